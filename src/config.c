@@ -0,0 +1,124 @@
+#define _DEFAULT_SOURCE
+#include "config.h"
+#include "util.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+  char *pattern; // NULL above the first section header
+  char *key;
+  char *value;
+} ConfigEntry;
+
+static struct {
+  ConfigEntry *entries;
+  size_t count;
+  struct stat st; // of the file the entries came from
+  int loaded;
+} config;
+
+static void config_clear(void) {
+  for (size_t i = 0; i < config.count; i++) {
+    free(config.entries[i].pattern);
+    free(config.entries[i].key);
+    free(config.entries[i].value);
+  }
+  free(config.entries);
+  config.entries = NULL;
+  config.count = 0;
+}
+
+static char *trim(char *s) {
+  while (isspace((unsigned char)*s))
+    s++;
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+static void config_read(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+  char buf[1024], pattern[512] = "";
+  int in_section = 0, skip = 0;
+  size_t alloc = 0;
+  for (int n = 1; fgets(buf, sizeof(buf), f); n++) {
+    char *line = trim(buf);
+    if (!line[0] || line[0] == '#')
+      continue;
+
+    size_t len = strlen(line);
+    if (line[0] == '[' && line[len - 1] == ']') {
+      line[len - 1] = '\0';
+      snprintf(pattern, sizeof(pattern), "%s", trim(line + 1));
+      in_section = 1;
+      // Keys under a bad header must not leak into the defaults.
+      skip = !pattern[0];
+      if (skip)
+        fprintf(stderr, "%s:%d: ignoring section without a pattern\n", path, n);
+      continue;
+    }
+    if (skip)
+      continue;
+
+    char *eq = strchr(line, '=');
+    if (!eq) {
+      fprintf(stderr, "%s:%d: expected key = value\n", path, n);
+      continue;
+    }
+    *eq = '\0';
+    if (config.count == alloc) {
+      alloc = alloc ? alloc * 2 : 16;
+      ConfigEntry *grown = realloc(config.entries, alloc * sizeof(*grown));
+      if (!grown)
+        break;
+      config.entries = grown;
+    }
+    config.entries[config.count++] = (ConfigEntry){
+      .pattern = in_section ? strdup(pattern) : NULL,
+      .key = strdup(trim(line)),
+      .value = strdup(trim(eq + 1)),
+    };
+  }
+  fclose(f);
+}
+
+// Load the file, or reload it if it changed since it was read.
+static void config_refresh(void) {
+  char *path = config_path("config");
+  struct stat st;
+  if (!path || stat(path, &st) != 0)
+    memset(&st, 0, sizeof(st));
+  if (!config.loaded || st.st_ino != config.st.st_ino || st.st_size != config.st.st_size ||
+      st.st_mtim.tv_sec != config.st.st_mtim.tv_sec ||
+      st.st_mtim.tv_nsec != config.st.st_mtim.tv_nsec) {
+    config_clear();
+    if (st.st_ino)
+      config_read(path);
+    config.st = st;
+    config.loaded = 1;
+  }
+  free(path);
+}
+
+const char *config_get(const char *remote, const char *key) {
+  config_refresh();
+  for (size_t i = 0; i < config.count; i++) {
+    const ConfigEntry *e = &config.entries[i];
+    if (e->pattern && e->key && e->value && strcmp(e->key, key) == 0 &&
+        fnmatch(e->pattern, remote, 0) == 0)
+      return e->value;
+  }
+  for (size_t i = 0; i < config.count; i++) {
+    const ConfigEntry *e = &config.entries[i];
+    if (!e->pattern && e->key && e->value && strcmp(e->key, key) == 0)
+      return e->value;
+  }
+  return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Settings from $XDG_CONFIG_HOME/h/config (or ~/.config/h/config), as
+// key = value lines under [pattern] headers. A pattern is a glob matched
+// against a repository's <host>/<path> below the code root, with * also
+// matching /. The first section that matches and sets a key decides it;
+// keys above the first header apply to every repository when no section
+// does. Lines starting with # are comments.
+//
+//   root = ~/src
+//
+//   [git.corp.example.com/*]
+//   root = ~/work
+//
+// The file is re-read when it changes, so a long-lived process (the bash
+// builtin) sees edits.
+
+// Value of key for the repository at remote, or NULL if none is set.
+const char *config_get(const char *remote, const char *key);
+
+#endif
@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "fuzzy.h"
+#include "index.h"
+#include "walk.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 3
+#define WATCH_MASK                                                                                 \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define SETTLE_MS 50
+#define REWALK_AFTER 256 // refreshes before a full walk reclaims dropped nodes
+#define REQUEST_MAX 512
+#define RESPONSE_MAX (MAX_MATCHES * PATH_MAX + 2)
+
+typedef struct {
+  const char *code_root;
+  WalkTree tree;
+  Index idx;
+  int inotify_fd;
+  WalkNode **watches; // indexed by watch descriptor
+  int watch_cap;
+  WalkNode **dirty;
+  size_t ndirty, dirty_cap;
+  int full;
+  int refreshes;
+} Daemon;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int socket_path(const char *code_root, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  char name[64];
+  snprintf(name, sizeof(name), "h-%016llx.sock", (unsigned long long)hash_str(code_root));
+
+  size_t len;
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime && runtime[0] == '/') {
+    len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", runtime, name);
+  } else {
+    char *path = cache_path(name);
+    if (!path)
+      return 0;
+    len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    free(path);
+  }
+  return len < sizeof(addr->sun_path);
+}
+
+static void add_watches(Daemon *d, WalkNode *node, WalkNode ***table, int *cap) {
+  if (node->depth >= MAX_DEPTH)
+    return;
+  char path[PATH_MAX];
+  if (walk_node_path(node, d->code_root, path, sizeof(path))) {
+    int wd = inotify_add_watch(d->inotify_fd, path, WATCH_MASK);
+    if (wd >= *cap) {
+      int grown = wd * 2 + 64;
+      WalkNode **p = realloc(*table, grown * sizeof(*p));
+      if (p) {
+        memset(p + *cap, 0, (grown - *cap) * sizeof(*p));
+        *table = p;
+        *cap = grown;
+      }
+    }
+    if (wd >= 0 && wd < *cap)
+      (*table)[wd] = node;
+  }
+  for (uint32_t i = 0; i < node->child_count; i++)
+    add_watches(d, node->children[i], table, cap);
+}
+
+// Re-add watches for the current tree (the kernel hands back the same
+// descriptor for directories already watched) and drop the rest.
+static void rewatch(Daemon *d) {
+  WalkNode **table = NULL;
+  int cap = 0;
+  add_watches(d, &d->tree.root, &table, &cap);
+  for (int wd = 0; wd < d->watch_cap; wd++)
+    if (d->watches[wd] && (wd >= cap || !table[wd]))
+      inotify_rm_watch(d->inotify_fd, wd);
+  free(d->watches);
+  d->watches = table;
+  d->watch_cap = cap;
+}
+
+static int compare_depth(const void *a, const void *b) {
+  const WalkNode *na = *(WalkNode *const *)a, *nb = *(WalkNode *const *)b;
+  if (na->depth != nb->depth)
+    return na->depth < nb->depth ? -1 : 1;
+  return na < nb ? -1 : na > nb;
+}
+
+static void reload(Daemon *d) {
+  if (!d->full && d->refreshes + d->ndirty > REWALK_AFTER)
+    d->full = 1;
+
+  if (d->full) {
+    walk_free(&d->tree);
+    walk_tree(d->code_root, MAX_DEPTH, 0, &d->tree);
+    d->refreshes = 0;
+  } else {
+    // Parents first, so a child refreshed after its parent sees the new
+    // listing; duplicates sort next to each other.
+    qsort(d->dirty, d->ndirty, sizeof(*d->dirty), compare_depth);
+    for (size_t i = 0; i < d->ndirty; i++) {
+      if (i > 0 && d->dirty[i] == d->dirty[i - 1])
+        continue;
+      walk_refresh(&d->tree, d->code_root, d->dirty[i], MAX_DEPTH);
+      d->refreshes++;
+    }
+  }
+  d->ndirty = 0;
+  d->full = 0;
+
+  rewatch(d);
+  index_close(&d->idx);
+  index_from_tree(d->code_root, &d->tree.root, &d->idx);
+}
+
+static void mark_dirty(Daemon *d, WalkNode *node) {
+  if (d->ndirty == d->dirty_cap) {
+    size_t cap = d->dirty_cap ? d->dirty_cap * 2 : 64;
+    WalkNode **p = realloc(d->dirty, cap * sizeof(*p));
+    if (!p) {
+      d->full = 1;
+      return;
+    }
+    d->dirty = p;
+    d->dirty_cap = cap;
+  }
+  d->dirty[d->ndirty++] = node;
+}
+
+static void read_events(Daemon *d) {
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(d->inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(*ev) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        d->full = 1;
+        continue;
+      }
+      if (ev->mask & IN_IGNORED || ev->wd < 0 || ev->wd >= d->watch_cap || !d->watches[ev->wd])
+        continue;
+      WalkNode *node = d->watches[ev->wd];
+      if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        if (node->parent)
+          mark_dirty(d, node->parent);
+        else
+          d->full = 1;
+      } else {
+        mark_dirty(d, node);
+      }
+    }
+  }
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return 0;
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static void set_timeouts(int fd) {
+  struct timeval tv = {.tv_sec = 1};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Request: "<mode> <term>\n". Response: one path per line, then an empty
+// line.
+static void serve(Daemon *d, int client) {
+  set_timeouts(client);
+  char req[REQUEST_MAX];
+  size_t len = 0;
+  while (len < sizeof(req) - 1) {
+    ssize_t n = recv(client, req + len, sizeof(req) - 1 - len, 0);
+    if (n <= 0)
+      return;
+    len += n;
+    if (memchr(req, '\n', len))
+      break;
+  }
+  req[len] = '\0';
+  char *nl = strchr(req, '\n');
+  if (!nl || len < 3 || req[1] != ' ')
+    return;
+  *nl = '\0';
+  const char *term = req + 2;
+
+  Matches matches = {.count = 0};
+  if (req[0] == DAEMON_FUZZY)
+    fuzzy_lookup(&d->idx, d->code_root, term, FUZZY_NONE, &matches);
+  else if (req[0] == DAEMON_FALLBACK)
+    fuzzy_lookup(&d->idx, d->code_root, term, fuzzy_min_score(term), &matches);
+  else
+    index_lookup(&d->idx, d->code_root, term, req[0] == DAEMON_EXACT_CASE, &matches);
+
+  static char resp[RESPONSE_MAX];
+  size_t rlen = 0;
+  for (int i = 0; i < matches.count; i++)
+    rlen += snprintf(resp + rlen, sizeof(resp) - rlen, "%s\n", matches.paths[i]);
+  resp[rlen++] = '\n';
+  send_all(client, resp, rlen);
+  matches_free(&matches);
+}
+
+int daemon_run(const char *code_root) {
+  struct sockaddr_un addr;
+  if (!socket_path(code_root, &addr))
+    return fail("Socket path too long");
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0)
+    return fail("Cannot create socket");
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    // Either another daemon owns the socket or a dead one left it behind.
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int alive = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (probe >= 0)
+      close(probe);
+    if (alive || errno != ECONNREFUSED || unlink(addr.sun_path) != 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(listen_fd);
+      return fail(alive ? "Daemon already running" : "Cannot bind daemon socket");
+    }
+  }
+  if (listen(listen_fd, 16) != 0) {
+    close(listen_fd);
+    return fail("Cannot listen on daemon socket");
+  }
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  Daemon d = {.code_root = code_root, .full = 1};
+  d.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (d.inotify_fd < 0) {
+    unlink(addr.sun_path);
+    close(listen_fd);
+    return fail("Cannot initialize inotify");
+  }
+  reload(&d);
+
+  while (!stop) {
+    struct pollfd fds[2] = {
+      {.fd = listen_fd, .events = POLLIN},
+      {.fd = d.inotify_fd, .events = POLLIN},
+    };
+    // Let bursts of events (a clone, an rm -rf) settle before re-listing.
+    int n = poll(fds, 2, d.ndirty || d.full ? SETTLE_MS : -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents & POLLIN)
+      read_events(&d);
+    if (n == 0)
+      reload(&d);
+    if (fds[0].revents & POLLIN) {
+      int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (client >= 0) {
+        // Events queued before the client connected may not have been read
+        // yet; without them a lookup right after a mkdir or a clone would
+        // miss the new directory.
+        read_events(&d);
+        if (d.ndirty || d.full)
+          reload(&d);
+        serve(&d, client);
+        close(client);
+      }
+    }
+  }
+
+  unlink(addr.sun_path);
+  close(listen_fd);
+  close(d.inotify_fd);
+  index_close(&d.idx);
+  walk_free(&d.tree);
+  free(d.watches);
+  free(d.dirty);
+  return 0;
+}
+
+int daemon_query(const char *code_root, int mode, const char *term, Matches *matches) {
+  struct sockaddr_un addr;
+  if (!socket_path(code_root, &addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  set_timeouts(fd);
+
+  char req[REQUEST_MAX];
+  size_t len = snprintf(req, sizeof(req), "%c %s\n", mode, term);
+  char *resp = malloc(RESPONSE_MAX);
+  size_t rlen = 0;
+  int complete = 0;
+  if (resp && len < sizeof(req) && send_all(fd, req, len)) {
+    ssize_t n;
+    while (!complete && rlen < RESPONSE_MAX - 1 &&
+           (n = recv(fd, resp + rlen, RESPONSE_MAX - 1 - rlen, 0)) > 0) {
+      rlen += n;
+      complete = (rlen == 1 && resp[0] == '\n') ||
+                 (rlen >= 2 && resp[rlen - 1] == '\n' && resp[rlen - 2] == '\n');
+    }
+  }
+  close(fd);
+
+  int count = -1;
+  if (complete) {
+    resp[rlen] = '\0';
+    for (char *line = resp; *line != '\n';) {
+      char *nl = strchr(line, '\n');
+      *nl = '\0';
+      matches_add(matches, line);
+      line = nl + 1;
+    }
+    count = matches->count;
+  }
+  free(resp);
+  return count;
+}
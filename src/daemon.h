@@ -0,0 +1,24 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "util.h"
+
+// Resident resolver: holds the walked tree of a code root in memory, keeps
+// it current with inotify watches on the directories whose listings make up
+// the first three levels, and answers lookups over a Unix socket in
+// $XDG_RUNTIME_DIR.
+
+// Lookup modes, sent as the first byte of a request.
+#define DAEMON_EXACT 'i'      // case-insensitive exact name
+#define DAEMON_EXACT_CASE 'c' // case-sensitive exact name
+#define DAEMON_FUZZY 'f'      // best fuzzy matches
+#define DAEMON_FALLBACK 'b'   // best fuzzy matches scoring fuzzy_min_score
+
+// Serve code_root until SIGINT or SIGTERM. Returns the exit status.
+int daemon_run(const char *code_root);
+
+// Ask a running daemon for matches. Returns -1 when no daemon answers, so
+// the caller can fall back to its own lookup, else the match count.
+int daemon_query(const char *code_root, int mode, const char *term, Matches *matches);
+
+#endif
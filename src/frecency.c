@@ -0,0 +1,159 @@
+#define _DEFAULT_SOURCE
+#include "frecency.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROBE_LIMIT 16
+#define DECAY_INTERVAL (24 * 60 * 60)
+#define MIN_COUNT (FRECENCY_UNIT / 4)
+
+typedef struct {
+  FrecencyHeader hdr;
+  FrecencyRecord records[FRECENCY_SLOTS];
+} FrecencyFile;
+
+static uint64_t hash_path(const char *s) {
+  uint64_t h = hash_str(s);
+  return h ? h : 1;
+}
+
+static FrecencyFile *frecency_open(int *fd) {
+  char *path = state_path("frecency");
+  if (!path)
+    return NULL;
+  FrecencyFile *f = map_file(path, sizeof(FrecencyFile), fd);
+  free(path);
+  if (!f)
+    return NULL;
+  if (f->hdr.magic != FRECENCY_MAGIC || f->hdr.version != FRECENCY_VERSION) {
+    // New or from an incompatible version: start over.
+    memset(f, 0, sizeof(*f));
+    f->hdr.magic = FRECENCY_MAGIC;
+    f->hdr.version = FRECENCY_VERSION;
+    f->hdr.last_decay = time(NULL);
+  }
+  return f;
+}
+
+static void frecency_close(FrecencyFile *f, int fd) {
+  munmap(f, sizeof(*f));
+  close(fd);
+}
+
+static double score(const FrecencyRecord *r, time_t now) {
+  double count = (double)r->count / FRECENCY_UNIT;
+  time_t age = now - (time_t)r->last_visit;
+  if (age < 60 * 60)
+    return count * 4;
+  if (age < 24 * 60 * 60)
+    return count * 2;
+  if (age < 7 * 24 * 60 * 60)
+    return count / 2;
+  return count / 4;
+}
+
+static FrecencyRecord *find(FrecencyFile *f, const char *path, uint64_t hash) {
+  for (int i = 0; i < PROBE_LIMIT; i++) {
+    FrecencyRecord *r = &f->records[(hash + i) % FRECENCY_SLOTS];
+    if (!r->hash)
+      return NULL;
+    if (r->hash == hash && strncmp(r->path, path, sizeof(r->path)) == 0)
+      return r;
+  }
+  return NULL;
+}
+
+// Age every count and drop the ones that faded out, rehashing survivors
+// so probe chains stay unbroken.
+static void decay(FrecencyFile *f, time_t now) {
+  static FrecencyRecord live[FRECENCY_SLOTS];
+  int n = 0;
+  for (int i = 0; i < FRECENCY_SLOTS; i++) {
+    FrecencyRecord *r = &f->records[i];
+    if (!r->hash)
+      continue;
+    r->count -= r->count >> 4;
+    if (r->count >= MIN_COUNT)
+      live[n++] = *r;
+  }
+  memset(f->records, 0, sizeof(f->records));
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < PROBE_LIMIT; j++) {
+      FrecencyRecord *r = &f->records[(live[i].hash + j) % FRECENCY_SLOTS];
+      if (!r->hash) {
+        *r = live[i];
+        break;
+      }
+    }
+  }
+  f->hdr.last_decay = now;
+}
+
+void frecency_visit(const char *path) {
+  if (strlen(path) >= sizeof(((FrecencyRecord *)0)->path))
+    return;
+  int fd;
+  FrecencyFile *f = frecency_open(&fd);
+  if (!f)
+    return;
+  flock(fd, LOCK_EX);
+
+  time_t now = time(NULL);
+  if (now - (time_t)f->hdr.last_decay >= DECAY_INTERVAL)
+    decay(f, now);
+
+  uint64_t hash = hash_path(path);
+  FrecencyRecord *slot = NULL, *weakest = NULL;
+  for (int i = 0; i < PROBE_LIMIT; i++) {
+    FrecencyRecord *r = &f->records[(hash + i) % FRECENCY_SLOTS];
+    if (!r->hash || (r->hash == hash && strcmp(r->path, path) == 0)) {
+      slot = r;
+      break;
+    }
+    if (!weakest || score(r, now) < score(weakest, now))
+      weakest = r;
+  }
+  if (!slot) {
+    // Probe window full: evict the weakest record in it.
+    slot = weakest;
+    slot->hash = 0;
+  }
+  if (!slot->hash) {
+    memset(slot, 0, sizeof(*slot));
+    slot->hash = hash;
+    strcpy(slot->path, path);
+  }
+  if (slot->count <= UINT32_MAX - FRECENCY_UNIT)
+    slot->count += FRECENCY_UNIT;
+  slot->last_visit = now;
+
+  flock(fd, LOCK_UN);
+  frecency_close(f, fd);
+}
+
+int frecency_pick(const Matches *m) {
+  if (m->count < 2)
+    return 0;
+  int fd;
+  FrecencyFile *f = frecency_open(&fd);
+  if (!f)
+    return 0;
+
+  time_t now = time(NULL);
+  int best = 0;
+  double best_score = 0;
+  for (int i = 0; i < m->count; i++) {
+    FrecencyRecord *r = find(f, m->paths[i], hash_path(m->paths[i]));
+    double s = r ? score(r, now) : 0;
+    if (s > best_score) {
+      best = i;
+      best_score = s;
+    }
+  }
+  frecency_close(f, fd);
+  return best;
+}
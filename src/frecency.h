@@ -0,0 +1,37 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include "util.h"
+#include <stdint.h>
+
+// Visit history for ranking ambiguous lookups, kept in a fixed-size
+// open-addressed table mapped from $XDG_STATE_HOME/h/frecency. Counts are
+// fixed point (FRECENCY_UNIT per visit) so daily decay stays in integers.
+
+#define FRECENCY_MAGIC 0x43455246 // "FREC"
+#define FRECENCY_VERSION 1
+#define FRECENCY_SLOTS 2048
+#define FRECENCY_UNIT 256
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t last_decay;
+  char pad[48];
+} FrecencyHeader;
+
+typedef struct {
+  uint64_t hash; // 0 marks an empty slot
+  uint32_t count;
+  uint32_t last_visit;
+  char path[240];
+} FrecencyRecord;
+
+// Record a visit to path. Constant time apart from the once-a-day decay.
+void frecency_visit(const char *path);
+
+// Index of the highest-ranked candidate; the first one when none has
+// history, which preserves the caller's own preference order.
+int frecency_pick(const Matches *m);
+
+#endif
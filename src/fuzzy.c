@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include "fuzzy.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define SCORE_MATCH 16
+#define BONUS_CONSECUTIVE 8
+#define BONUS_BOUNDARY 8
+#define BONUS_SUBSTRING 16
+#define BONUS_EXACT 32
+#define PENALTY_GAP 3
+
+uint64_t fuzzy_mask(const char *key) {
+  uint64_t mask = 0;
+  for (; *key; key++) {
+    unsigned char c = *key;
+    if (c >= 'a' && c <= 'z')
+      mask |= 1ULL << (c - 'a');
+    else if (c >= '0' && c <= '9')
+      mask |= 1ULL << (26 + c - '0');
+    else if (c == '-')
+      mask |= 1ULL << 36;
+    else if (c == '_')
+      mask |= 1ULL << 37;
+    else if (c == '.')
+      mask |= 1ULL << 38;
+    else
+      mask |= 1ULL << 39;
+  }
+  return mask;
+}
+
+static int is_boundary(char c) {
+  return c == '-' || c == '_' || c == '.';
+}
+
+int fuzzy_score(const char *name, size_t len, const char *query, size_t qlen) {
+  if (qlen == 0 || qlen > len)
+    return FUZZY_NONE;
+
+  const char *sub = memmem(name, len, query, qlen);
+  if (sub) {
+    int score = SCORE_MATCH * qlen + BONUS_CONSECUTIVE * (qlen - 1) + BONUS_SUBSTRING;
+    if (sub == name || is_boundary(sub[-1]))
+      score += BONUS_BOUNDARY;
+    if (qlen == len)
+      score += BONUS_EXACT;
+    return score - (int)(len - qlen);
+  }
+
+  // Find the first end of a subsequence match, then walk back from it to
+  // the latest possible start so the scored window is as tight as it gets.
+  size_t qi = 0, end = 0;
+  for (size_t i = 0; i < len && qi < qlen; i++) {
+    if (name[i] == query[qi]) {
+      qi++;
+      end = i;
+    }
+  }
+  if (qi < qlen)
+    return FUZZY_NONE;
+  size_t start = end;
+  for (size_t i = end + 1; i-- > 0;) {
+    if (name[i] == query[qi - 1] && --qi == 0) {
+      start = i;
+      break;
+    }
+  }
+
+  int score = 0;
+  size_t prev = SIZE_MAX;
+  qi = 0;
+  for (size_t i = start; i <= end && qi < qlen; i++) {
+    if (name[i] != query[qi]) {
+      score -= PENALTY_GAP;
+      continue;
+    }
+    score += SCORE_MATCH;
+    if (prev != SIZE_MAX && prev + 1 == i)
+      score += BONUS_CONSECUTIVE;
+    if (i == 0 || is_boundary(name[i - 1]))
+      score += BONUS_BOUNDARY;
+    prev = i;
+    qi++;
+  }
+  return score - (int)(len - qlen);
+}
+
+static size_t
+prefilter_scalar(const uint64_t *masks, size_t i, size_t count, uint64_t q, uint32_t *out) {
+  size_t n = 0;
+  for (; i < count; i++)
+    if ((masks[i] & q) == q)
+      out[n++] = i;
+  return n;
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of the x86-64 baseline; it lacks a 64-bit compare, so both
+// 32-bit halves of a lane must compare equal.
+static size_t prefilter_sse2(const uint64_t *masks, size_t count, uint64_t q, uint32_t *out) {
+  __m128i vq = _mm_set1_epi64x(q);
+  size_t n = 0, i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i m = _mm_loadu_si128((const __m128i *)(masks + i));
+    __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(m, vq), vq);
+    int bits = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    if ((bits & 3) == 3)
+      out[n++] = i;
+    if ((bits & 12) == 12)
+      out[n++] = i + 1;
+  }
+  return n + prefilter_scalar(masks, i, count, q, out + n);
+}
+
+__attribute__((target("avx2"))) static size_t
+prefilter_avx2(const uint64_t *masks, size_t count, uint64_t q, uint32_t *out) {
+  __m256i vq = _mm256_set1_epi64x(q);
+  size_t n = 0, i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i m = _mm256_loadu_si256((const __m256i *)(masks + i));
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(m, vq), vq);
+    int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    while (bits) {
+      out[n++] = i + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+  return n + prefilter_scalar(masks, i, count, q, out + n);
+}
+#endif
+
+// Write the indices of all names containing every character class in q.
+static size_t prefilter(const uint64_t *masks, size_t count, uint64_t q, uint32_t *out) {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    return prefilter_avx2(masks, count, q, out);
+  return prefilter_sse2(masks, count, q, out);
+#else
+  return prefilter_scalar(masks, 0, count, q, out);
+#endif
+}
+
+static const Index *sort_index;
+
+static int compare_hits(const void *a, const void *b) {
+  const FuzzyHit *ha = a, *hb = b;
+  if (ha->score != hb->score)
+    return ha->score > hb->score ? -1 : 1;
+  // Same preference as exact lookups: deepest first, then walk order.
+  uint16_t da = sort_index->entries[ha->entry].depth, db = sort_index->entries[hb->entry].depth;
+  if (da != db)
+    return da > db ? -1 : 1;
+  return ha->entry < hb->entry ? -1 : 1;
+}
+
+size_t fuzzy_rank(const Index *idx, const char *term, FuzzyHit *hits, size_t max_hits) {
+  char query[256];
+  size_t qlen = strlen(term);
+  if (qlen == 0 || qlen >= sizeof(query) || idx->count == 0)
+    return 0;
+  for (size_t i = 0; i <= qlen; i++)
+    query[i] = tolower((unsigned char)term[i]);
+
+  uint32_t *candidates = malloc(idx->count * sizeof(*candidates));
+  FuzzyHit *all = malloc(idx->count * sizeof(*all));
+  size_t n = 0;
+  if (candidates && all) {
+    size_t count = prefilter(idx->masks, idx->count, fuzzy_mask(query), candidates);
+    for (size_t i = 0; i < count; i++) {
+      const IndexEntry *e = &idx->entries[candidates[i]];
+      int score = fuzzy_score(idx->strings + e->key, e->len, query, qlen);
+      if (score != FUZZY_NONE)
+        all[n++] = (FuzzyHit){.entry = candidates[i], .score = score};
+    }
+    sort_index = idx;
+    qsort(all, n, sizeof(*all), compare_hits);
+    if (n > max_hits)
+      n = max_hits;
+    memcpy(hits, all, n * sizeof(*hits));
+  }
+  free(candidates);
+  free(all);
+  return n;
+}
+
+// SCORE_MATCH per query character: the bonuses of a mostly contiguous
+// match make up for a letter or two left out, while a query scattered
+// across a long name loses more to gaps than it gains.
+int fuzzy_min_score(const char *term) {
+  size_t qlen = strlen(term);
+  return qlen < FUZZY_MIN_QUERY ? INT_MAX : (int)(SCORE_MATCH * qlen);
+}
+
+int fuzzy_lookup(const Index *idx,
+                 const char *code_root,
+                 const char *term,
+                 int min_score,
+                 Matches *matches) {
+  FuzzyHit hits[MAX_MATCHES];
+  size_t n = fuzzy_rank(idx, term, hits, MAX_MATCHES);
+  if (n == 0 || hits[0].score < min_score)
+    return matches->count;
+  for (size_t i = 0; i < n && hits[i].score == hits[0].score; i++) {
+    char path[PATH_MAX];
+    if (index_entry_path(idx, hits[i].entry, code_root, path, sizeof(path)))
+      matches_add(matches, path);
+  }
+  return matches->count;
+}
@@ -0,0 +1,44 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include "index.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Subsequence/substring matching over the index name table. A 64-bit mask
+// of the character classes in each folded name lets a SIMD pass discard
+// names missing any query character before anything is scored.
+
+#define FUZZY_LIMIT 20
+
+typedef struct {
+  uint32_t entry;
+  int score;
+} FuzzyHit;
+
+// Character-class mask of a case-folded string.
+uint64_t fuzzy_mask(const char *key);
+
+// Score a folded name against a folded query. Returns FUZZY_NONE when the
+// query isn't a subsequence of the name.
+#define FUZZY_NONE INT32_MIN
+int fuzzy_score(const char *name, size_t len, const char *query, size_t qlen);
+
+// Rank entries matching term, best first. Returns the number of hits written.
+size_t fuzzy_rank(const Index *idx, const char *term, FuzzyHit *hits, size_t max_hits);
+
+// Lowest score a plain lookup takes when it falls back to fuzzy matching,
+// so a short query or a badly mistyped one doesn't land in an unrelated
+// project. Queries under FUZZY_MIN_QUERY characters never qualify.
+#define FUZZY_MIN_QUERY 3
+int fuzzy_min_score(const char *term);
+
+// Add the paths of the best-scoring entries (all ties) to matches, unless
+// they score below min_score; FUZZY_NONE takes any match.
+int fuzzy_lookup(const Index *idx,
+                 const char *code_root,
+                 const char *term,
+                 int min_score,
+                 Matches *matches);
+
+#endif
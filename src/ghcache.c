@@ -0,0 +1,113 @@
+#define _DEFAULT_SOURCE
+#include "ghcache.h"
+#include "util.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PROBE_LIMIT 8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  char pad[56];
+  GithubCacheRecord records[GHCACHE_SLOTS];
+} GithubCacheFile;
+
+static GithubCacheFile *ghcache_open(int *fd) {
+  char *path = cache_path("github");
+  if (!path)
+    return NULL;
+  GithubCacheFile *f = map_file(path, sizeof(GithubCacheFile), fd);
+  free(path);
+  if (!f)
+    return NULL;
+  if (f->magic != GHCACHE_MAGIC || f->version != GHCACHE_VERSION) {
+    memset(f, 0, sizeof(*f));
+    f->magic = GHCACHE_MAGIC;
+    f->version = GHCACHE_VERSION;
+  }
+  return f;
+}
+
+static void ghcache_close(GithubCacheFile *f, int fd) {
+  munmap(f, sizeof(*f));
+  close(fd);
+}
+
+static int make_key(const char *user, const char *repo, char *key, size_t key_size) {
+  if ((size_t)snprintf(key, key_size, "%s/%s", user, repo) >= key_size)
+    return 0;
+  for (char *c = key; *c; c++)
+    *c = tolower((unsigned char)*c);
+  return 1;
+}
+
+static uint64_t hash_key(const char *key) {
+  uint64_t h = hash_str(key);
+  return h ? h : 1;
+}
+
+int ghcache_lookup(const char *user, const char *repo, GithubCacheRecord *rec) {
+  char key[sizeof(rec->key)];
+  if (!make_key(user, repo, key, sizeof(key)))
+    return 0;
+  int fd;
+  GithubCacheFile *f = ghcache_open(&fd);
+  if (!f)
+    return 0;
+
+  uint64_t hash = hash_key(key);
+  int found = 0;
+  for (int i = 0; i < PROBE_LIMIT; i++) {
+    const GithubCacheRecord *r = &f->records[(hash + i) % GHCACHE_SLOTS];
+    if (!r->hash)
+      break;
+    if (r->hash == hash && strcmp(r->key, key) == 0) {
+      *rec = *r;
+      found = 1;
+      break;
+    }
+  }
+  ghcache_close(f, fd);
+  return found;
+}
+
+int ghcache_fresh(const GithubCacheRecord *rec, time_t now) {
+  time_t ttl = rec->state == GHCACHE_FOUND ? GHCACHE_TTL : GHCACHE_NEGATIVE_TTL;
+  return now - (time_t)rec->fetched_at < ttl;
+}
+
+void ghcache_store(const char *user, const char *repo, GithubCacheRecord *rec) {
+  if (!make_key(user, repo, rec->key, sizeof(rec->key)))
+    return;
+  rec->hash = hash_key(rec->key);
+  rec->fetched_at = time(NULL);
+
+  int fd;
+  GithubCacheFile *f = ghcache_open(&fd);
+  if (!f)
+    return;
+  flock(fd, LOCK_EX);
+
+  // Reuse the key's slot or the first empty one; with the probe window
+  // full, replace the entry fetched longest ago.
+  GithubCacheRecord *slot = NULL, *oldest = NULL;
+  for (int i = 0; i < PROBE_LIMIT; i++) {
+    GithubCacheRecord *r = &f->records[(rec->hash + i) % GHCACHE_SLOTS];
+    if (!r->hash || (r->hash == rec->hash && strcmp(r->key, rec->key) == 0)) {
+      slot = r;
+      break;
+    }
+    if (!oldest || r->fetched_at < oldest->fetched_at)
+      oldest = r;
+  }
+  *(slot ? slot : oldest) = *rec;
+
+  flock(fd, LOCK_UN);
+  ghcache_close(f, fd);
+}
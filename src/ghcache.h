@@ -0,0 +1,39 @@
+#ifndef GHCACHE_H
+#define GHCACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Persistent cache of GitHub owner/repo casing, keyed by the lower-cased
+// "user/repo" and mapped from $XDG_CACHE_HOME/h/github. Found entries are
+// trusted for GHCACHE_TTL and then revalidated with If-None-Match; misses
+// are remembered for GHCACHE_NEGATIVE_TTL so typos don't hit the API.
+
+#define GHCACHE_MAGIC 0x48434847 // "GHCH"
+#define GHCACHE_VERSION 1
+#define GHCACHE_SLOTS 1024
+#define GHCACHE_TTL (7 * 24 * 60 * 60)
+#define GHCACHE_NEGATIVE_TTL (10 * 60)
+
+enum { GHCACHE_FOUND = 1, GHCACHE_MISSING = 2 };
+
+typedef struct {
+  uint64_t hash; // 0 marks an empty slot
+  uint32_t fetched_at;
+  uint32_t state;
+  char key[144];
+  char owner[40];
+  char repo[104];
+  char etag[96];
+} GithubCacheRecord;
+
+// Copy the record for user/repo into *rec. Returns 0 if there is none.
+int ghcache_lookup(const char *user, const char *repo, GithubCacheRecord *rec);
+
+// Whether rec can be used without asking GitHub again.
+int ghcache_fresh(const GithubCacheRecord *rec, time_t now);
+
+// Insert or replace the record for user/repo, stamped now.
+void ghcache_store(const char *user, const char *repo, GithubCacheRecord *rec);
+
+#endif
@@ -0,0 +1,270 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+#include "util.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Times h, up and h-shell-init (the binaries next to this one) against a
+// synthetic code root of domains x owners x repos. Each repo has a .git
+// marker and a chain of noise directories below it for up to climb out of.
+
+typedef struct {
+  int domains, owners, repos, noise, runs;
+} Shape;
+
+static char bin_dir[PATH_MAX / 2];
+static int cold;
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: h-bench [--domains N] [--owners N] [--repos N] [--noise N] [--runs N]\n"
+          "               [--cold] [--keep] [--dir DIR]\n");
+}
+
+static int make_dir(const char *path) {
+  return mkdir(path, 0755) == 0 || is_dir(path);
+}
+
+static void repo_name(char *name, size_t size, int d, int o, int r) {
+  snprintf(name, size, "Repo%d_%d_%d", d, o, r);
+}
+
+static int generate(const char *root, const Shape *s, char *deep, size_t deep_size) {
+  char path[PATH_MAX];
+  if (!make_dir(root))
+    return 0;
+  for (int d = 0; d < s->domains; d++) {
+    for (int o = 0; o < s->owners; o++) {
+      for (int r = 0; r < s->repos; r++) {
+        char name[64];
+        repo_name(name, sizeof(name), d, o, r);
+        if (snprintf(path, sizeof(path), "%s/domain%d.com/owner%d/%s/.git", root, d, o, name) >=
+            (int)sizeof(path))
+          return 0;
+        mkpath(path);
+        size_t len = strlen(path) - strlen("/.git");
+        for (int n = 0; n < s->noise && len < sizeof(path) - 16; n++) {
+          len += snprintf(path + len, sizeof(path) - len, "/noise%d", n);
+          if (!make_dir(path))
+            return 0;
+        }
+        path[len] = '\0';
+        // up starts from the deepest directory of the repo lookups target.
+        if (d == s->domains / 2 && o == s->owners / 2 && r == s->repos / 2)
+          snprintf(deep, deep_size, "%s", path);
+      }
+    }
+  }
+  return 1;
+}
+
+static void drop_caches(void) {
+  sync();
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+  if (fd >= 0) {
+    if (write(fd, "3", 1) != 1)
+      perror("drop_caches");
+    close(fd);
+  }
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Run argv once with output discarded. Returns the wall time in
+// microseconds, or -1 if it couldn't be started.
+static double run_once(char *const argv[], const char *pwd) {
+  if (cold)
+    drop_caches();
+  double start = now_us();
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    if (pwd && (chdir(pwd) != 0 || setenv("PWD", pwd, 1) != 0))
+      _exit(127);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    return -1;
+  double elapsed = now_us() - start;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 127 ? -1 : elapsed;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const double *samples, int n, int p) {
+  int rank = (p * n + 99) / 100;
+  return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static int bench(const char *label, char *const argv[], const char *pwd, int runs) {
+  double *samples = malloc(runs * sizeof(*samples));
+  if (!samples)
+    return 0;
+  for (int i = 0; i < runs; i++) {
+    samples[i] = run_once(argv, pwd);
+    if (samples[i] < 0) {
+      fprintf(stderr, "Failed to run %s\n", argv[0]);
+      free(samples);
+      return 0;
+    }
+  }
+  qsort(samples, runs, sizeof(*samples), compare_doubles);
+  printf("%-24s %9.3f %9.3f %9.3f %9.3f\n",
+         label,
+         percentile(samples, runs, 50) / 1e3,
+         percentile(samples, runs, 90) / 1e3,
+         percentile(samples, runs, 99) / 1e3,
+         samples[runs - 1] / 1e3);
+  free(samples);
+  return 1;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static int parse_count(const char *arg, int *out) {
+  char *end;
+  long n = strtol(arg, &end, 10);
+  if (*end || n < 1 || n > 100000)
+    return 0;
+  *out = n;
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  Shape s = {.domains = 4, .owners = 50, .repos = 20, .noise = 8, .runs = 50};
+  const char *dir_arg = NULL;
+  int keep = 0;
+
+  for (int i = 1; i < argc; i++) {
+    int *count = NULL;
+    if (strcmp(argv[i], "--domains") == 0)
+      count = &s.domains;
+    else if (strcmp(argv[i], "--owners") == 0)
+      count = &s.owners;
+    else if (strcmp(argv[i], "--repos") == 0)
+      count = &s.repos;
+    else if (strcmp(argv[i], "--noise") == 0)
+      count = &s.noise;
+    else if (strcmp(argv[i], "--runs") == 0)
+      count = &s.runs;
+
+    if (count) {
+      if (i + 1 >= argc || !parse_count(argv[++i], count)) {
+        usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--cold") == 0) {
+      cold = 1;
+    } else if (strcmp(argv[i], "--keep") == 0) {
+      keep = 1;
+    } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      dir_arg = argv[++i];
+    } else {
+      usage();
+      return strcmp(argv[i], "-h") != 0 && strcmp(argv[i], "--help") != 0;
+    }
+  }
+
+  if (cold && access("/proc/sys/vm/drop_caches", W_OK) != 0)
+    return fail("--cold needs write access to /proc/sys/vm/drop_caches (run as root)");
+
+  ssize_t len = readlink("/proc/self/exe", bin_dir, sizeof(bin_dir) - 1);
+  if (len == -1)
+    return fail("Cannot locate the binaries to benchmark");
+  bin_dir[len] = '\0';
+  *strrchr(bin_dir, '/') = '\0';
+
+  char work[PATH_MAX / 2];
+  // A directory the caller named is theirs to clean up.
+  keep |= dir_arg != NULL;
+  if (dir_arg) {
+    snprintf(work, sizeof(work), "%s", dir_arg);
+    mkpath(work);
+  } else {
+    snprintf(work, sizeof(work), "/tmp/h-bench-XXXXXX");
+    if (!mkdtemp(work))
+      return fail("Cannot create a work directory");
+  }
+
+  // Keep the index, frecency store and daemon socket out of the user's dirs.
+  char root[PATH_MAX], path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cache", work);
+  setenv("XDG_CACHE_HOME", path, 1);
+  snprintf(path, sizeof(path), "%s/state", work);
+  setenv("XDG_STATE_HOME", path, 1);
+  snprintf(path, sizeof(path), "%s/run", work);
+  mkpath(path);
+  setenv("XDG_RUNTIME_DIR", path, 1);
+  snprintf(root, sizeof(root), "%s/root", work);
+
+  char deep[PATH_MAX] = "";
+  double start = now_us();
+  if (!generate(root, &s, deep, sizeof(deep)))
+    return fail("Cannot generate the code root");
+  printf("%d repos (%d domains x %d owners x %d repos, %d noise levels) in %.0f ms\n",
+         s.domains * s.owners * s.repos,
+         s.domains,
+         s.owners,
+         s.repos,
+         s.noise,
+         (now_us() - start) / 1e3);
+  if (keep)
+    printf("Code root: %s\n", root);
+  printf("%d runs each, %s cache, times in ms\n\n", s.runs, cold ? "cold" : "warm");
+
+  char h[PATH_MAX], up[PATH_MAX], shell_init[PATH_MAX];
+  snprintf(h, sizeof(h), "%s/h", bin_dir);
+  snprintf(up, sizeof(up), "%s/up", bin_dir);
+  snprintf(shell_init, sizeof(shell_init), "%s/h-shell-init", bin_dir);
+
+  char exact[64], folded[64];
+  repo_name(exact, sizeof(exact), s.domains / 2, s.owners / 2, s.repos / 2);
+  for (size_t i = 0; i <= strlen(exact); i++)
+    folded[i] = tolower((unsigned char)exact[i]);
+
+  printf("%-24s %9s %9s %9s %9s\n", "case", "p50", "p90", "p99", "max");
+  int ok = bench("h-shell-init", (char *[]){shell_init, root, NULL}, NULL, s.runs);
+  for (int indexed = 0; ok && indexed <= 1; indexed++) {
+    if (indexed)
+      ok = bench("h --reindex", (char *[]){h, "--reindex", root, NULL}, NULL, s.runs);
+    const char *mode = indexed ? "index" : "walk";
+    char label[64];
+    snprintf(label, sizeof(label), "h exact (%s)", mode);
+    ok = ok && bench(label, (char *[]){h, "--resolve", root, exact, NULL}, NULL, s.runs);
+    snprintf(label, sizeof(label), "h case-insens. (%s)", mode);
+    ok = ok && bench(label, (char *[]){h, "--resolve", root, folded, NULL}, NULL, s.runs);
+    snprintf(label, sizeof(label), "h miss (%s)", mode);
+    ok = ok && bench(label, (char *[]){h, "--resolve", root, "nosuchproject", NULL}, NULL, s.runs);
+  }
+  ok = ok && bench("up (deep)", (char *[]){up, NULL}, deep, s.runs);
+
+  if (!keep)
+    nftw(work, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  return !ok;
+}
@@ -0,0 +1,109 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE // dladdr
+#include "resolve.h"
+#include "trace.h"
+#include "util.h"
+#include <dlfcn.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <loadables.h>
+
+// Bash loadable builtin running h --resolve inside the shell, so `h` costs
+// no fork or exec unless it has to clone:
+//
+//   enable -f /path/to/h.so h_resolve
+//   h_resolve <code-root> <term> [git opts]   # sets _h_dir
+//
+// Only symbols below are exported (the objects are built with hidden
+// visibility), so bash's own functions can't interpose on ours.
+
+#define EXPORT __attribute__((visibility("default")))
+
+// h.so sits next to h-net in the build directory, and in <prefix>/lib/bash
+// with h-net in <prefix>/bin once installed. Point self_exe at a program in
+// that directory so resolve_term's sibling lookup finds the helper there
+// rather than next to bash.
+static int locate_helper(void) {
+  Dl_info info;
+  char module[PATH_MAX], exe[PATH_MAX + 16];
+  if (!dladdr((void *)locate_helper, &info) || !realpath(info.dli_fname, module))
+    return 0;
+  char *slash = strrchr(module, '/');
+  *slash = '\0';
+  snprintf(exe, sizeof(exe), "%s/h-net", module);
+  if (access(exe, X_OK) != 0)
+    snprintf(exe, sizeof(exe), "%s/../../bin/h", module);
+  free((char *)self_exe);
+  self_exe = strdup(exe);
+  return self_exe != NULL;
+}
+
+static int h_resolve_builtin(WORD_LIST *list) {
+  int argc = 0;
+  for (WORD_LIST *l = list; l; l = l->next)
+    argc++;
+  if (argc < 2) {
+    builtin_usage();
+    return EX_USAGE;
+  }
+  char **argv = malloc((argc + 1) * sizeof(*argv));
+  if (!argv)
+    return EXECUTION_FAILURE;
+  argc = 0;
+  for (WORD_LIST *l = list; l; l = l->next)
+    argv[argc++] = l->word->word;
+  argv[argc] = NULL;
+
+  // Bash reaps children from its SIGCHLD handler, which would steal git's
+  // and h-net's exit status from our waitpid.
+  sigset_t chld, old;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old);
+  child_sigmask = &old;
+
+  trace_begin("h");
+  char *code_root = expand_tilde(argv[0]);
+  char path[PATH_MAX];
+  int ret = resolve_term(code_root, argc - 1, argv + 1, "h", path, sizeof(path));
+  free(code_root);
+  trace_end();
+  free(argv);
+  child_sigmask = NULL;
+  sigprocmask(SIG_SETMASK, &old, NULL);
+
+  // On failure stay where we are, like the shell function does.
+  if (ret != 0 && !getcwd(path, sizeof(path)))
+    path[0] = '\0';
+  bind_variable("_h_dir", path, 0);
+  return ret;
+}
+
+EXPORT int h_resolve_builtin_load(char *name) {
+  (void)name;
+  return locate_helper();
+}
+
+static char *h_resolve_doc[] = {
+  "Resolve an h term to a directory.",
+  "",
+  "Looks TERM up under CODE-ROOT as `h --resolve' does, cloning it with the",
+  "given git options if needed, and stores the directory in _h_dir (the",
+  "current directory on failure). Used by the function h-shell-init defines.",
+  NULL,
+};
+
+EXPORT struct builtin h_resolve_struct = {
+  "h_resolve",
+  h_resolve_builtin,
+  BUILTIN_ENABLED,
+  h_resolve_doc,
+  "h_resolve code-root term [git-options ...]",
+  0,
+};
@@ -0,0 +1,40 @@
+#define _DEFAULT_SOURCE
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+
+// Multi-call binary: h, up, h-shell-init and up-shell-init in one
+// executable, picked by the name it is run as (through a symlink) or by
+// its first argument. Each program's main is renamed when compiled for it.
+// Network requests still go to the separate h-net helper.
+
+int h_main(int argc, char **argv);
+int up_main(int argc, char **argv);
+int h_shell_init_main(int argc, char **argv);
+int up_shell_init_main(int argc, char **argv);
+
+static const struct {
+  const char *name;
+  int (*main)(int argc, char **argv);
+} programs[] = {
+  {"h", h_main},
+  {"up", up_main},
+  {"h-shell-init", h_shell_init_main},
+  {"up-shell-init", up_shell_init_main},
+};
+
+#define PROGRAM_COUNT (sizeof(programs) / sizeof(*programs))
+
+int main(int argc, char **argv) {
+  multicall = 1;
+  const char *base = strrchr(argv[0], '/');
+  base = base ? base + 1 : argv[0];
+  for (size_t i = 0; i < PROGRAM_COUNT; i++)
+    if (strcmp(base, programs[i].name) == 0)
+      return programs[i].main(argc, argv);
+  if (argc > 1)
+    for (size_t i = 0; i < PROGRAM_COUNT; i++)
+      if (strcmp(argv[1], programs[i].name) == 0)
+        return programs[i].main(argc - 1, argv + 1);
+  return fail("Usage: h-multi (h | up | h-shell-init | up-shell-init) [args...]");
+}
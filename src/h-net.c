@@ -0,0 +1,403 @@
+#define _DEFAULT_SOURCE
+#include "ghcache.h"
+#include "net.h"
+#include "trace.h"
+#include "util.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cjson/cJSON.h>
+#include <curl/curl.h>
+
+// Network helper for h: answers the requests described in net.h, one per
+// line on stdin, until EOF. Kept out of h so that local lookups never pay
+// for loading libcurl, cJSON and the TLS stack.
+//
+// What a run learns about the API host is kept for the next one in
+// $XDG_CACHE_HOME/h/net (mode 0600: it holds TLS session tickets), one
+// tab-separated record per line:
+//
+//   dns <TAB> host:port:address <TAB> expiry
+//   tls <TAB> session key <TAB> expiry <TAB> hex shmac <TAB> hex session
+//
+// The address lets the next run skip DNS and the sessions let it resume
+// TLS instead of doing a full handshake; the latter needs libcurl 8.12 for
+// exporting sessions.
+
+#define API_HOST "api.github.com"
+#define API_PORT "443"
+// A dead network should fail the lookup quickly; a slow API may take longer.
+#define CONNECT_TIMEOUT_MS 2000L
+#define TOTAL_TIMEOUT_MS 8000L
+// How long a remembered address is used without resolving the name again.
+#define DNS_TTL 600
+
+#define HAVE_SSLS_EXPORT (LIBCURL_VERSION_NUM >= 0x080c00)
+
+#define cleanup(func) __attribute__((cleanup(func)))
+
+static void free_char(char **p) {
+  free(*p);
+}
+static void free_curl(CURL **p) {
+  if (*p)
+    curl_easy_cleanup(*p);
+}
+static void free_slist(struct curl_slist **p) {
+  if (*p)
+    curl_slist_free_all(*p);
+}
+static void free_cjson(cJSON **p) {
+  if (*p)
+    cJSON_Delete(*p);
+}
+static void free_share(CURLSH **p) {
+  if (*p)
+    curl_share_cleanup(*p);
+}
+static void curl_cleanup(char *p) {
+  (void)p;
+  curl_global_cleanup();
+}
+
+typedef struct {
+  char *data;
+  size_t size;
+} Buffer;
+
+static void free_buffer(Buffer *p) {
+  free(p->data);
+}
+
+// Bytes received for the current request, reported back to h with the
+// reply so its trace and stats count them.
+static size_t fetched;
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+  size_t total = size * nmemb;
+  fetched += total;
+  Buffer *buf = (Buffer *)userp;
+  char *ptr = realloc(buf->data, buf->size + total + 1);
+  if (!ptr)
+    return 0;
+  buf->data = ptr;
+  memcpy(&buf->data[buf->size], contents, total);
+  buf->size += total;
+  buf->data[buf->size] = '\0';
+  return total;
+}
+
+static size_t header_callback(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t total = size * nitems;
+  fetched += total;
+  char *etag = userp;
+  if (total > 5 && strncasecmp(buffer, "etag:", 5) == 0) {
+    const char *v = buffer + 5;
+    size_t len = total - 5;
+    while (len && (*v == ' ' || *v == '\t')) {
+      v++;
+      len--;
+    }
+    while (len && (v[len - 1] == '\r' || v[len - 1] == '\n' || v[len - 1] == ' '))
+      len--;
+    if (len < sizeof(((GithubCacheRecord *)0)->etag)) {
+      memcpy(etag, v, len);
+      etag[len] = '\0';
+    }
+  }
+  return total;
+}
+
+typedef struct {
+  CURLSH *share;             // DNS and TLS session caches of the run
+  char resolve[128];         // pinned address as CURLOPT_RESOLVE wants it
+  time_t resolve_expiry;
+  struct curl_slist *pinned; // resolve as a list, or NULL when not pinned
+  int network_down;          // a connect failed; don't wait on it again
+  int learned;               // a request completed, so there may be news
+} NetState;
+
+static void free_state(NetState *st) {
+  if (st->pinned)
+    curl_slist_free_all(st->pinned);
+  st->pinned = NULL;
+}
+
+static void pin_address(NetState *st, const char *resolve, time_t expiry) {
+  free_state(st);
+  snprintf(st->resolve, sizeof(st->resolve), "%s", resolve);
+  st->resolve_expiry = expiry;
+  if (resolve[0])
+    st->pinned = curl_slist_append(NULL, st->resolve);
+}
+
+#if HAVE_SSLS_EXPORT
+static int hex_value(char c) {
+  return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Decode hex in place. Returns the byte count, or -1 if it isn't hex.
+static long unhex(char *s) {
+  size_t len = strlen(s);
+  if (len % 2)
+    return -1;
+  for (size_t i = 0; i < len / 2; i++) {
+    int hi = hex_value(s[2 * i]), lo = hex_value(s[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return -1;
+    s[i] = (char)(hi << 4 | lo);
+  }
+  return len / 2;
+}
+#endif
+
+static void load_cache(CURL *curl, NetState *st) {
+  cleanup(free_char) char *path = cache_path("net");
+  FILE *f = path ? fopen(path, "r") : NULL;
+  if (!f)
+    return;
+  time_t now = time(NULL);
+  cleanup(free_char) char *line = NULL;
+  size_t cap = 0;
+  while (getline(&line, &cap, f) > 0) {
+    char *fields[5];
+    int n = net_split(line, fields, 5);
+    time_t expiry = n >= 3 ? (time_t)strtoll(fields[2], NULL, 10) : 0;
+    if (expiry <= now)
+      continue;
+    if (n == 3 && strcmp(fields[0], "dns") == 0) {
+      pin_address(st, fields[1], expiry);
+    } else if (n == 5 && strcmp(fields[0], "tls") == 0) {
+#if HAVE_SSLS_EXPORT
+      long shmac_len = unhex(fields[3]), sdata_len = unhex(fields[4]);
+      if (shmac_len >= 0 && sdata_len > 0)
+        curl_easy_ssls_import(curl,
+                              fields[1],
+                              (unsigned char *)fields[3],
+                              shmac_len,
+                              (unsigned char *)fields[4],
+                              sdata_len);
+#else
+      (void)curl;
+#endif
+    }
+  }
+  fclose(f);
+}
+
+#if HAVE_SSLS_EXPORT
+static void put_hex(FILE *f, const unsigned char *data, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    fprintf(f, "%02x", data[i]);
+}
+
+static CURLcode export_session(CURL *curl,
+                               void *userptr,
+                               const char *session_key,
+                               const unsigned char *shmac,
+                               size_t shmac_len,
+                               const unsigned char *sdata,
+                               size_t sdata_len,
+                               curl_off_t valid_until,
+                               int ietf_tls_id,
+                               const char *alpn,
+                               size_t earlydata_max) {
+  (void)curl;
+  (void)ietf_tls_id;
+  (void)alpn;
+  (void)earlydata_max;
+  FILE *f = userptr;
+  if (strpbrk(session_key, "\t\n"))
+    return CURLE_OK;
+  fprintf(f, "tls\t%s\t%lld\t", session_key, (long long)valid_until);
+  put_hex(f, shmac, shmac_len);
+  fputc('\t', f);
+  put_hex(f, sdata, sdata_len);
+  fputc('\n', f);
+  return CURLE_OK;
+}
+#endif
+
+// Replace the cache file with what this run knows.
+static void save_cache(CURL *curl, NetState *st) {
+  cleanup(free_char) char *path = cache_path("net");
+  if (!path)
+    return;
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (!f) {
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  if (st->resolve[0])
+    fprintf(f, "dns\t%s\t%lld\n", st->resolve, (long long)st->resolve_expiry);
+#if HAVE_SSLS_EXPORT
+  curl_easy_ssls_export(curl, export_session, f);
+#else
+  (void)curl;
+#endif
+  if (fclose(f) != 0 || rename(tmp, path) != 0)
+    unlink(tmp);
+}
+
+// Remember the address the last transfer connected to.
+static void learn_address(CURL *curl, NetState *st) {
+  char *ip = NULL;
+  if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || !ip || !ip[0])
+    return;
+  char resolve[sizeof(st->resolve)];
+  // IPv6 addresses go in brackets.
+  if (strchr(ip, ':'))
+    snprintf(resolve, sizeof(resolve), "%s:%s:[%s]", API_HOST, API_PORT, ip);
+  else
+    snprintf(resolve, sizeof(resolve), "%s:%s:%s", API_HOST, API_PORT, ip);
+  if (strcmp(resolve, st->resolve) != 0)
+    pin_address(st, resolve, time(NULL) + DNS_TTL);
+}
+
+// Whether the transfer failed before a connection was made, as opposed to
+// the API being slow.
+static int connect_failed(CURL *curl, CURLcode res) {
+  if (res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_CONNECT)
+    return 1;
+  curl_off_t connected = 0;
+  return res == CURLE_OPERATION_TIMEDOUT &&
+         curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connected) == CURLE_OK && connected == 0;
+}
+
+// See net_github. The handle is reset, not recreated, so its connection
+// and TLS session caches carry over between requests.
+static int fetch_github_repo_info(CURL *curl,
+                                  NetState *st,
+                                  const char *user,
+                                  const char *repo,
+                                  GithubCacheRecord *rec) {
+  if (st->network_down)
+    return NET_ERROR;
+  char url[512];
+  snprintf(url, sizeof(url), "https://" API_HOST "/repos/%s/%s", user, repo);
+  curl_easy_reset(curl);
+
+  cleanup(free_buffer) Buffer buf = {0};
+  cleanup(free_slist) struct curl_slist *headers = NULL;
+  headers = curl_slist_append(headers, "User-Agent: h-cli");
+  headers = curl_slist_append(headers, "Accept: application/vnd.github.v3+json");
+  if (rec->etag[0]) {
+    char if_none_match[sizeof(rec->etag) + 32];
+    snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s", rec->etag);
+    headers = curl_slist_append(headers, if_none_match);
+  }
+
+  char etag[sizeof(rec->etag)] = "";
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)etag);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, TOTAL_TIMEOUT_MS);
+  curl_easy_setopt(curl, CURLOPT_SHARE, st->share);
+  curl_easy_setopt(curl, CURLOPT_RESOLVE, st->pinned);
+
+  CURLcode res = curl_easy_perform(curl);
+  if (st->pinned && connect_failed(curl, res)) {
+    // The remembered address may be gone: drop it from the DNS cache and
+    // resolve the name again.
+    pin_address(st, "", 0);
+    cleanup(free_slist) struct curl_slist *unpin =
+        curl_slist_append(NULL, "-" API_HOST ":" API_PORT);
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, unpin);
+    buf.size = 0;
+    etag[0] = '\0';
+    res = curl_easy_perform(curl);
+  }
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+  if (res != CURLE_OK) {
+    st->network_down = connect_failed(curl, res);
+    return NET_ERROR;
+  }
+  learn_address(curl, st);
+  st->learned = 1;
+  if (http_code == 304)
+    return NET_NOT_MODIFIED;
+  if (http_code == 404)
+    return NET_NOT_FOUND;
+  if (http_code != 200 || !buf.data)
+    return NET_ERROR;
+
+  cleanup(free_cjson) cJSON *json = cJSON_Parse(buf.data);
+  if (!json)
+    return NET_ERROR;
+
+  cJSON *owner_obj = cJSON_GetObjectItem(json, "owner");
+  cJSON *name_obj = cJSON_GetObjectItem(json, "name");
+
+  if (owner_obj && name_obj) {
+    cJSON *login = cJSON_GetObjectItem(owner_obj, "login");
+    if (login && cJSON_IsString(login) && cJSON_IsString(name_obj) &&
+        strlen(login->valuestring) < sizeof(rec->owner) &&
+        strlen(name_obj->valuestring) < sizeof(rec->repo)) {
+      strcpy(rec->owner, login->valuestring);
+      strcpy(rec->repo, name_obj->valuestring);
+      strcpy(rec->etag, etag);
+      return NET_OK;
+    }
+  }
+
+  return NET_ERROR;
+}
+
+int main(void) {
+  trace_start("h-net");
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  cleanup(curl_cleanup) char curl_guard = 0;
+  // The share goes after the handle using it, hence declared first.
+  cleanup(free_share) CURLSH *share = curl_share_init();
+  cleanup(free_curl) CURL *curl = curl_easy_init();
+  if (!curl || !share)
+    return 1;
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  cleanup(free_state) NetState st = {.share = share};
+  // Sessions are imported into the share, which the handle needs to have.
+  curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  load_cache(curl, &st);
+
+  cleanup(free_char) char *line = NULL;
+  size_t cap = 0;
+  while (getline(&line, &cap, stdin) > 0) {
+    char *fields[4];
+    GithubCacheRecord rec = {0};
+    int status = NET_ERROR;
+    if (net_split(line, fields, 4) == 4 && strcmp(fields[0], "github") == 0 &&
+        strlen(fields[3]) < sizeof(rec.etag)) {
+      trace_phase("github_api");
+      strcpy(rec.etag, fields[3]);
+      fetched = 0;
+      status = fetch_github_repo_info(curl, &st, fields[1], fields[2], &rec);
+      trace_count(TRACE_BYTES, fetched);
+      trace_phase("idle");
+    }
+    printf("%s\t%s\t%s\t%s\t%zu\n",
+           net_status_names[status],
+           rec.owner,
+           rec.repo,
+           rec.etag,
+           fetched);
+    fflush(stdout);
+  }
+  if (st.learned)
+    save_cache(curl, &st);
+  return 0;
+}
@@ -6,6 +6,53 @@
 #include <string.h>
 #include <unistd.h>
 
+// Print the h function around a command that sets _h_dir: call_head, the
+// arguments after the code root, then call_tail. With git options, a term
+// is followed by them and then whatever git options the user gave. h's own
+// commands, such as --fuzzy and --sync, take no git options, which would be
+// read as their arguments, so they are passed on as given.
+static void print_function(const char *func_name,
+                           const char *call_head,
+                           const char *call_tail,
+                           const char *git_opts,
+                           const char *cd_cmd) {
+  printf("%s() {\n", func_name);
+  if (git_opts[0])
+    printf("  case \"$1\" in\n"
+           "  -*) %s \"$@\"%s ;;\n"
+           "  *)\n"
+           "    _h_term=\"$1\"\n"
+           "    shift\n"
+           "    %s \"$_h_term\" %s \"$@\"%s\n"
+           "    ;;\n"
+           "  esac\n",
+           call_head,
+           call_tail,
+           call_head,
+           git_opts,
+           call_tail);
+  else
+    printf("  %s \"$@\"%s\n", call_head, call_tail);
+  printf("  _h_ret=$?\n"
+         "  [ \"$_h_dir\" != \"$PWD\" ] && %s \"$_h_dir\"\n"
+         "  return $_h_ret\n"
+         "}\n",
+         cd_cmd);
+}
+
+// Find the bash builtin next to us (build directory) or in lib/bash beside
+// our bin directory (installed).
+static int find_builtin(const char *argv0, char *out, size_t out_size) {
+  const char *candidates[] = {"h.so", "../lib/bash/h.so"};
+  for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+    char path[PATH_MAX];
+    sibling_path(candidates[i], argv0, path, sizeof(path));
+    if (out_size >= PATH_MAX && realpath(path, out) && access(out, R_OK) == 0)
+      return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
   const char *func_name = "h";
   const char *cd_cmd = "cd";
@@ -37,114 +84,69 @@ int main(int argc, char **argv) {
     default_root = "~/src";
   if (!code_root_arg)
     code_root_arg = default_root;
-  char *code_root = expand_tilde(code_root_arg);
+  // The function runs h with the roots as given, so expand ~ in each now.
+  Roots roots;
+  if (!roots_parse(code_root_arg, &roots))
+    return fail("No code root given");
+  char code_root[PATH_MAX * 2] = "";
+  for (int i = 0; i < roots.count; i++) {
+    size_t len = strlen(code_root);
+    snprintf(code_root + len, sizeof(code_root) - len, "%s%s", i ? ":" : "", roots.paths[i]);
+  }
+  roots_free(&roots);
 
   char exe[PATH_MAX];
-  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
-  if (len == -1) {
-    char *pwd = getenv("PWD");
-    if (!pwd)
-      pwd = ".";
-    if (argv[0][0] == '/')
-      strncpy(exe, argv[0], sizeof(exe) - 1);
-    else
-      snprintf(exe, sizeof(exe), "%s/%s", pwd, argv[0]);
-  } else {
-    exe[len] = '\0';
-  }
+  program_path("h", argv[0], exe, sizeof(exe));
 
-  // Replace "h-shell-init" with "h" in the path
-  char *basename = strrchr(exe, '/');
-  if (basename) {
-    snprintf(basename + 1, sizeof(exe) - (basename - exe) - 1, "h");
-  } else {
-    strncpy(exe, "h", sizeof(exe) - 1);
-  }
-
-  if (git_opts[0]) {
-    printf("%s() {\n"
-           "  _h_term=\"$1\"\n"
-           "  shift\n"
-           "  _h_dir=$(command %s --resolve \"%s\" \"$_h_term\" %s \"$@\")\n"
-           "  _h_ret=$?\n"
-           "  [ \"$_h_dir\" != \"$PWD\" ] && %s \"$_h_dir\"\n"
-           "  return $_h_ret\n"
-           "}\n",
-           func_name,
-           exe,
-           code_root,
-           git_opts,
-           cd_cmd);
-  } else {
-    printf("%s() {\n"
-           "  _h_dir=$(command %s --resolve \"%s\" \"$@\")\n"
-           "  _h_ret=$?\n"
-           "  [ \"$_h_dir\" != \"$PWD\" ] && %s \"$_h_dir\"\n"
-           "  return $_h_ret\n"
-           "}\n",
-           func_name,
-           exe,
-           code_root,
-           cd_cmd);
-  }
+  char call[PATH_MAX * 2];
+  snprintf(call, sizeof(call), "_h_dir=$(command %s --resolve \"%s\"", exe, code_root);
+  print_function(func_name, call, ")", git_opts, cd_cmd);
 
   // Detect parent shell to emit only compatible completion code.
   // Emitting both zsh and bash branches in a single if/elif/fi doesn't work
   // because bash parses zsh glob qualifiers like *(N/:t) as syntax errors
   // even inside an untaken branch.
-  enum { SHELL_UNKNOWN, SHELL_BASH, SHELL_ZSH } shell = SHELL_UNKNOWN;
-  char parent_comm[256] = "";
-  char proc_path[64];
-  snprintf(proc_path, sizeof(proc_path), "/proc/%d/comm", getppid());
-  FILE *f = fopen(proc_path, "r");
-  if (f) {
-    if (fgets(parent_comm, sizeof(parent_comm), f)) {
-      parent_comm[strcspn(parent_comm, "\n")] = '\0';
-      if (strcmp(parent_comm, "zsh") == 0)
-        shell = SHELL_ZSH;
-      else if (strcmp(parent_comm, "bash") == 0)
-        shell = SHELL_BASH;
-    }
-    fclose(f);
-  }
+  Shell shell = parent_shell();
 
-  // Output tab completion for the detected shell
+  // Output tab completion for the detected shell. h --complete filters by
+  // prefix itself (case-insensitively for lower-case prefixes, like
+  // lookups), so the shell takes its output as-is.
   if (shell == SHELL_ZSH) {
     printf("_%s_complete() {\n"
-           "  local code_root='%s'\n"
            "  local -a projects\n"
-           "  [[ -d \"$code_root\" ]] || return\n"
-           "  projects=(\n"
-           "    \"$code_root\"/*(N/:t)\n"
-           "    \"$code_root\"/*/*(N/:t)\n"
-           "    \"$code_root\"/*/*/*(N/:t)\n"
-           "  )\n"
-           "  projects=(\"${(u)projects[@]}\")\n"
-           "  compadd -a projects\n"
+           "  projects=(${(f)\"$(command %s --complete '%s' \"$PREFIX\" 2>/dev/null)\"})\n"
+           "  compadd -U -a projects\n"
            "}\n"
            "compdef _%s_complete %s\n",
            func_name,
+           exe,
            code_root,
            func_name,
            func_name);
   } else if (shell == SHELL_BASH) {
     printf("_%s_complete() {\n"
-           "  local cur=\"${COMP_WORDS[COMP_CWORD]}\"\n"
-           "  local code_root='%s'\n"
            "  COMPREPLY=()\n"
-           "  [[ -d \"$code_root\" ]] || return\n"
-           "  local dirs\n"
-           "  dirs=$(find \"$code_root\" -mindepth 1 -maxdepth 3 -type d "
-           "-not -name '.*' 2>/dev/null | sed 's|.*/||' | sort -u)\n"
-           "  COMPREPLY=($(compgen -W \"$dirs\" -- \"$cur\"))\n"
+           "  mapfile -t COMPREPLY < <(command %s --complete '%s' "
+           "\"${COMP_WORDS[COMP_CWORD]}\" 2>/dev/null)\n"
            "}\n"
            "complete -F _%s_complete %s\n",
            func_name,
+           exe,
            code_root,
            func_name,
            func_name);
+
+    // With the loadable builtin, h resolves inside the shell without a fork.
+    // The function above stays as the fallback if bash can't load it.
+    char module[PATH_MAX];
+    if (find_builtin(argv[0], module, sizeof(module))) {
+      char call[PATH_MAX * 2];
+      snprintf(call, sizeof(call), "h_resolve \"%s\"", code_root);
+      printf("if enable -f '%s' h_resolve 2>/dev/null; then\n", module);
+      print_function(func_name, call, "", git_opts, cd_cmd);
+      printf("fi\n");
+    }
   }
 
-  free(code_root);
   return 0;
 }
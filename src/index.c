@@ -0,0 +1,536 @@
+#define _DEFAULT_SOURCE
+#include "index.h"
+#include "fuzzy.h"
+#include "trace.h"
+#include "util.h"
+#include "walk.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 3
+
+typedef struct {
+  IndexEntry *entries;
+  uint64_t *masks;
+  size_t count, cap;
+  IndexDir *dirs;
+  size_t dir_count, dir_cap;
+  char *strings;
+  size_t strings_size, strings_cap;
+} Builder;
+
+char *index_path(const char *code_root) {
+  char name[64];
+  snprintf(name, sizeof(name), "index-%016llx", (unsigned long long)hash_str(code_root));
+  return cache_path(name);
+}
+
+static uint32_t add_string(Builder *b, const char *s, size_t len) {
+  if (b->strings_size + len + 1 > b->strings_cap) {
+    size_t cap = b->strings_cap ? b->strings_cap * 2 : 65536;
+    while (cap < b->strings_size + len + 1)
+      cap *= 2;
+    char *p = realloc(b->strings, cap);
+    if (!p)
+      return UINT32_MAX;
+    b->strings = p;
+    b->strings_cap = cap;
+  }
+  uint32_t off = b->strings_size;
+  memcpy(b->strings + off, s, len);
+  b->strings[off + len] = '\0';
+  b->strings_size += len + 1;
+  return off;
+}
+
+static int add_entry(Builder *b, const char *name, uint32_t parent, int depth) {
+  size_t len = strlen(name);
+  if (len > UINT16_MAX)
+    return 0;
+  if (b->count == b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 1024;
+    IndexEntry *p = realloc(b->entries, cap * sizeof(*p));
+    if (!p)
+      return 0;
+    b->entries = p;
+    uint64_t *m = realloc(b->masks, cap * sizeof(*m));
+    if (!m)
+      return 0;
+    b->masks = m;
+    b->cap = cap;
+  }
+
+  char key[256];
+  int folded = 0;
+  for (size_t i = 0; i < len && i < sizeof(key) - 1; i++) {
+    key[i] = tolower((unsigned char)name[i]);
+    folded |= key[i] != name[i];
+  }
+  key[len < sizeof(key) - 1 ? len : sizeof(key) - 1] = '\0';
+
+  IndexEntry *e = &b->entries[b->count];
+  e->name = add_string(b, name, len);
+  // Names that are already lower case share their string with the key.
+  e->key = folded ? add_string(b, key, strlen(key)) : e->name;
+  if (e->name == UINT32_MAX || e->key == UINT32_MAX)
+    return 0;
+  e->parent = parent;
+  e->len = len;
+  e->depth = depth;
+  b->masks[b->count] = fuzzy_mask(key);
+  b->count++;
+  return 1;
+}
+
+// Record the mtime of a directory the walk listed; unlisted ones have none.
+static int add_dir(Builder *b, const WalkNode *node, uint32_t entry) {
+  if (node->mtime_sec == 0 && node->mtime_nsec == 0)
+    return 1;
+  if (b->dir_count == b->dir_cap) {
+    size_t cap = b->dir_cap ? b->dir_cap * 2 : 256;
+    IndexDir *p = realloc(b->dirs, cap * sizeof(*p));
+    if (!p)
+      return 0;
+    b->dirs = p;
+    b->dir_cap = cap;
+  }
+  b->dirs[b->dir_count++] = (IndexDir){
+    .mtime_sec = node->mtime_sec,
+    .mtime_nsec = node->mtime_nsec,
+    .entry = entry,
+  };
+  return 1;
+}
+
+static void collect(Builder *b, const WalkNode *node, uint32_t parent) {
+  for (uint32_t i = 0; i < node->child_count; i++) {
+    const WalkNode *child = node->children[i];
+    if (!add_entry(b, child->name, parent, child->depth) || !add_dir(b, child, b->count - 1))
+      return;
+    collect(b, child, b->count - 1);
+  }
+}
+
+static const Builder *sort_builder;
+
+static int compare_keys(const void *a, const void *b) {
+  const IndexEntry *ea = &sort_builder->entries[*(const uint32_t *)a];
+  const IndexEntry *eb = &sort_builder->entries[*(const uint32_t *)b];
+  int c = strcmp(sort_builder->strings + ea->key, sort_builder->strings + eb->key);
+  if (c)
+    return c;
+  // Deepest first, then walk order, so the first hit is search_dir's answer.
+  if (ea->depth != eb->depth)
+    return ea->depth > eb->depth ? -1 : 1;
+  return *(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1;
+}
+
+static size_t blob_size(uint32_t count, uint32_t dir_count, size_t strings_size) {
+  return sizeof(IndexHeader) +
+         (size_t)count * (sizeof(IndexEntry) + sizeof(uint64_t) + sizeof(uint32_t)) +
+         (size_t)dir_count * sizeof(IndexDir) + strings_size;
+}
+
+// Lay the index for a walked tree out in a single heap buffer.
+static void *build_blob(const char *code_root, const WalkNode *root, size_t *size) {
+  // Preorder over the walk keeps readdir order, so entry order preserves
+  // search_dir's tie-breaking.
+  Builder b = {0};
+  add_string(&b, code_root, strlen(code_root));
+  add_dir(&b, root, INDEX_NONE);
+  collect(&b, root, INDEX_NONE);
+
+  char *blob = NULL;
+  uint32_t *sorted = malloc((b.count ? b.count : 1) * sizeof(*sorted));
+  if (sorted && b.strings) {
+    for (size_t i = 0; i < b.count; i++)
+      sorted[i] = i;
+    sort_builder = &b;
+    qsort(sorted, b.count, sizeof(*sorted), compare_keys);
+
+    *size = blob_size(b.count, b.dir_count, b.strings_size);
+    blob = malloc(*size);
+  }
+  if (blob) {
+    IndexHeader hdr = {
+      .magic = INDEX_MAGIC,
+      .version = INDEX_VERSION,
+      .count = b.count,
+      .strings_size = b.strings_size,
+      .dir_count = b.dir_count,
+    };
+    char *p = blob;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, b.entries, b.count * sizeof(*b.entries));
+    p += b.count * sizeof(*b.entries);
+    memcpy(p, b.masks, b.count * sizeof(*b.masks));
+    p += b.count * sizeof(*b.masks);
+    memcpy(p, b.dirs, b.dir_count * sizeof(*b.dirs));
+    p += b.dir_count * sizeof(*b.dirs);
+    memcpy(p, sorted, b.count * sizeof(*sorted));
+    p += b.count * sizeof(*sorted);
+    memcpy(p, b.strings, b.strings_size);
+  }
+
+  free(sorted);
+  free(b.entries);
+  free(b.masks);
+  free(b.dirs);
+  free(b.strings);
+  return blob;
+}
+
+// Whether every offset in the tables points inside the blob, so a corrupt
+// or truncated file can't send a lookup outside the mapping. Parents come
+// before their children in walk order, which also rules out cycles.
+static int valid_tables(const IndexHeader *hdr,
+                        const IndexEntry *entries,
+                        const IndexDir *dirs,
+                        const uint32_t *sorted) {
+  // The string table ends with a NUL, so a name that starts inside it ends
+  // inside it too.
+  uint32_t limit = hdr->strings_size - 1;
+  for (uint32_t i = 0; i < hdr->count; i++) {
+    const IndexEntry *e = &entries[i];
+    if (e->name >= limit || e->key >= limit || e->len > limit - e->key ||
+        e->len > limit - e->name || (e->parent != INDEX_NONE && e->parent >= i) ||
+        sorted[i] >= hdr->count)
+      return 0;
+  }
+  for (uint32_t i = 0; i < hdr->dir_count; i++)
+    if (dirs[i].entry != INDEX_NONE && dirs[i].entry >= hdr->count)
+      return 0;
+  return 1;
+}
+
+// Point idx at a blob after checking it belongs to code_root.
+static int attach(Index *idx, void *blob, size_t size, const char *code_root) {
+  const IndexHeader *hdr = blob;
+  if (size < sizeof(*hdr) || hdr->magic != INDEX_MAGIC || hdr->version != INDEX_VERSION ||
+      hdr->strings_size == 0 || blob_size(hdr->count, hdr->dir_count, hdr->strings_size) != size)
+    return 0;
+  const char *strings = (const char *)blob + size - hdr->strings_size;
+  if (strings[hdr->strings_size - 1] != '\0' || strcmp(strings, code_root) != 0)
+    return 0;
+  const IndexEntry *entries = (const IndexEntry *)(hdr + 1);
+  const uint64_t *masks = (const uint64_t *)(entries + hdr->count);
+  const IndexDir *dirs = (const IndexDir *)(masks + hdr->count);
+  const uint32_t *sorted = (const uint32_t *)(dirs + hdr->dir_count);
+  if (!valid_tables(hdr, entries, dirs, sorted))
+    return 0;
+
+  idx->map = blob;
+  idx->size = size;
+  idx->count = hdr->count;
+  idx->entries = entries;
+  idx->masks = masks;
+  idx->dir_count = hdr->dir_count;
+  idx->dirs = dirs;
+  idx->sorted = sorted;
+  idx->strings = strings;
+  return 1;
+}
+
+static void *walk_blob(const char *code_root, size_t *size) {
+  WalkTree tree;
+  if (!walk_tree(code_root, MAX_DEPTH, WALK_MTIMES, &tree))
+    return NULL;
+  void *blob = build_blob(code_root, &tree.root, size);
+  walk_free(&tree);
+  return blob;
+}
+
+// Atomically replace the index file for code_root with blob.
+static int write_blob(const char *code_root, const void *blob, size_t size) {
+  char *path = index_path(code_root);
+  if (!path)
+    return 0;
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  FILE *f = fopen(tmp, "wb");
+  int ok = f && fwrite(blob, 1, size, f) == size;
+  ok = f && fclose(f) == 0 && ok;
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    ok = 0;
+  }
+  free(path);
+  return ok;
+}
+
+int index_build(const char *code_root) {
+  size_t size;
+  void *blob = walk_blob(code_root, &size);
+  if (!blob)
+    return 0;
+  int ok = write_blob(code_root, blob, size);
+  free(blob);
+  return ok;
+}
+
+// Returns 1 with idx attached, 0 if there is no index file to map, or -1 if
+// there is one but it can't be used.
+static int map_index(const char *code_root, Index *idx) {
+  memset(idx, 0, sizeof(*idx));
+  char *path = index_path(code_root);
+  if (!path)
+    return 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0)
+    return 0;
+
+  struct stat st;
+  int have_size = fstat(fd, &st) == 0;
+  void *map = MAP_FAILED;
+  if (have_size && (size_t)st.st_size >= sizeof(IndexHeader))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return have_size && (size_t)st.st_size < sizeof(IndexHeader) ? -1 : 0;
+  if (!attach(idx, map, st.st_size, code_root)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  return 1;
+}
+
+int index_open(const char *code_root, Index *idx) {
+  int ret = map_index(code_root, idx);
+  // There is an index, but it is truncated, corrupt or from another
+  // version: replace it rather than walking on every lookup until the next
+  // h --reindex.
+  if (ret < 0 && index_build(code_root))
+    ret = map_index(code_root, idx);
+  return ret > 0;
+}
+
+static int attach_owned(Index *idx, void *blob, size_t size, const char *code_root) {
+  if (!blob)
+    return 0;
+  if (!attach(idx, blob, size, code_root)) {
+    free(blob);
+    return 0;
+  }
+  idx->owned = 1;
+  return 1;
+}
+
+// Rebuild the walk tree an index was made from. Names point into the
+// index's string table, so idx must stay open while the tree is in use.
+// Entry i becomes (*nodes)[i].
+static int tree_from_index(const Index *idx, WalkTree *tree, WalkNode **nodes_out) {
+  walk_init(tree, WALK_MTIMES);
+  WalkNode *nodes = walk_alloc(tree, (idx->count ? idx->count : 1) * sizeof(*nodes));
+  if (!nodes)
+    return 0;
+  *nodes_out = nodes;
+
+  // Count children first so each node gets a single array; entries are in
+  // preorder, so filling them in entry order keeps readdir order.
+  for (uint32_t i = 0; i < idx->count; i++) {
+    const IndexEntry *e = &idx->entries[i];
+    WalkNode *parent = e->parent == INDEX_NONE ? &tree->root : &nodes[e->parent];
+    nodes[i] = (WalkNode){
+      .name = idx->strings + e->name,
+      .parent = parent,
+      .len = e->len,
+      .depth = e->depth,
+    };
+    parent->child_count++;
+  }
+  for (uint32_t i = 0; i <= idx->count; i++) {
+    WalkNode *node = i < idx->count ? &nodes[i] : &tree->root;
+    if (node->child_count == 0)
+      continue;
+    node->children = walk_alloc(tree, node->child_count * sizeof(*node->children));
+    if (!node->children)
+      return 0;
+    node->child_count = 0;
+  }
+  for (uint32_t i = 0; i < idx->count; i++) {
+    WalkNode *parent = nodes[i].parent;
+    parent->children[parent->child_count++] = &nodes[i];
+  }
+
+  for (uint32_t i = 0; i < idx->dir_count; i++) {
+    const IndexDir *d = &idx->dirs[i];
+    WalkNode *node = d->entry == INDEX_NONE ? &tree->root : &nodes[d->entry];
+    node->mtime_sec = d->mtime_sec;
+    node->mtime_nsec = d->mtime_nsec;
+  }
+  return 1;
+}
+
+int index_refresh(const char *code_root, Index *idx) {
+  if (idx->dir_count == 0)
+    return 1;
+  int root_fd = open(code_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0)
+    return 1;
+  uint32_t *changed = malloc(idx->dir_count * sizeof(*changed));
+  if (!changed) {
+    close(root_fd);
+    return 1;
+  }
+
+  // A directory's mtime moves whenever an entry is added, removed or
+  // renamed in it, so unchanged mtimes mean the listing is still good.
+  size_t nchanged = 0;
+  for (uint32_t i = 0; i < idx->dir_count; i++) {
+    const IndexDir *d = &idx->dirs[i];
+    char rel[PATH_MAX] = ".";
+    if (d->entry != INDEX_NONE && !index_entry_path(idx, d->entry, ".", rel, sizeof(rel)))
+      continue;
+    struct stat st;
+    trace_count(TRACE_STATS, 1);
+    if (fstatat(root_fd, rel, &st, 0) != 0 || st.st_mtim.tv_sec != d->mtime_sec ||
+        (uint32_t)st.st_mtim.tv_nsec != d->mtime_nsec)
+      changed[nchanged++] = i;
+  }
+  close(root_fd);
+  if (nchanged == 0) {
+    free(changed);
+    return 1;
+  }
+
+  WalkTree tree;
+  WalkNode *nodes;
+  void *blob = NULL;
+  size_t size;
+  if (tree_from_index(idx, &tree, &nodes)) {
+    // dirs is in preorder, so parents are re-listed before their children
+    // and a child that vanished is just listed as empty.
+    for (size_t i = 0; i < nchanged; i++) {
+      uint32_t entry = idx->dirs[changed[i]].entry;
+      walk_refresh(&tree, code_root, entry == INDEX_NONE ? &tree.root : &nodes[entry], MAX_DEPTH);
+    }
+    blob = build_blob(code_root, &tree.root, &size);
+  }
+  free(changed);
+  if (!blob) {
+    walk_free(&tree);
+    return 1;
+  }
+  write_blob(code_root, blob, size);
+  walk_free(&tree);
+  index_close(idx);
+  return attach_owned(idx, blob, size, code_root);
+}
+
+void index_update(const char *code_root) {
+  Index idx;
+  if (index_open(code_root, &idx) && index_refresh(code_root, &idx))
+    index_close(&idx);
+}
+
+int index_load(const char *code_root, Index *idx) {
+  memset(idx, 0, sizeof(*idx));
+  size_t size;
+  void *blob = walk_blob(code_root, &size);
+  return attach_owned(idx, blob, size, code_root);
+}
+
+int index_from_tree(const char *code_root, const WalkNode *root, Index *idx) {
+  memset(idx, 0, sizeof(*idx));
+  size_t size;
+  void *blob = build_blob(code_root, root, &size);
+  return attach_owned(idx, blob, size, code_root);
+}
+
+void index_close(Index *idx) {
+  if (idx->owned)
+    free(idx->map);
+  else if (idx->map)
+    munmap(idx->map, idx->size);
+  idx->map = NULL;
+}
+
+int index_entry_path(const Index *idx,
+                     uint32_t i,
+                     const char *code_root,
+                     char *path,
+                     size_t path_size) {
+  uint32_t chain[MAX_DEPTH];
+  int n = 0;
+  for (; i != INDEX_NONE && i < idx->count && n < MAX_DEPTH; i = idx->entries[i].parent)
+    chain[n++] = i;
+
+  size_t len = snprintf(path, path_size, "%s", code_root);
+  while (n-- > 0 && len < path_size)
+    len += snprintf(path + len, path_size - len, "/%s", idx->strings + idx->entries[chain[n]].name);
+  return len < path_size;
+}
+
+// Case-fold term into key. Returns 0 if it is too long to be a name.
+static int fold_key(const char *term, char *key, size_t key_size) {
+  size_t len = strlen(term);
+  if (len >= key_size)
+    return 0;
+  for (size_t i = 0; i <= len; i++)
+    key[i] = tolower((unsigned char)term[i]);
+  return 1;
+}
+
+// First position in the sorted table whose key is not less than key.
+static uint32_t lower_bound(const Index *idx, const char *key) {
+  size_t lo = 0, hi = idx->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(idx->strings + idx->entries[idx->sorted[mid]].key, key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+int index_lookup(const Index *idx,
+                 const char *code_root,
+                 const char *term,
+                 int case_sensitive,
+                 Matches *matches) {
+  char key[256];
+  if (!fold_key(term, key, sizeof(key)))
+    return 0;
+  size_t lo = lower_bound(idx, key);
+
+  for (; lo < idx->count; lo++) {
+    const IndexEntry *e = &idx->entries[idx->sorted[lo]];
+    if (strcmp(idx->strings + e->key, key) != 0)
+      break;
+    if (case_sensitive && strcmp(idx->strings + e->name, term) != 0)
+      continue;
+    char path[PATH_MAX];
+    if (index_entry_path(idx, idx->sorted[lo], code_root, path, sizeof(path)) &&
+        !matches_add(matches, path))
+      break;
+  }
+  return matches->count;
+}
+
+uint32_t index_prefix(const Index *idx, const char *prefix, uint32_t *end) {
+  char key[256];
+  if (!fold_key(prefix, key, sizeof(key))) {
+    *end = 0;
+    return 0;
+  }
+  uint32_t lo = lower_bound(idx, key);
+  // Keys sharing the prefix are contiguous, so the range ends at the first
+  // one that doesn't start with it.
+  size_t len = strlen(key);
+  uint32_t hi = lo;
+  while (hi < idx->count &&
+         strncmp(idx->strings + idx->entries[idx->sorted[hi]].key, key, len) == 0)
+    hi++;
+  *end = hi;
+  return lo;
+}
@@ -0,0 +1,106 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "util.h"
+#include "walk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk project index: every directory up to 3 levels below a code root,
+// in walk order, plus a table sorted by case-folded name for binary search.
+//
+// Layout: IndexHeader, IndexEntry[count], uint64_t masks[count],
+// IndexDir dirs[dir_count], uint32_t sorted[count], strings. masks holds the
+// fuzzy_mask of each case-folded name for the fuzzy prefilter. dirs records
+// the mtime of every directory that was listed (the root and everything
+// above the depth limit), so index_refresh can tell which ones changed
+// without listing them. The code root is stored as the first string so a
+// hash collision in the file name can't hand back another root's index.
+
+#define INDEX_MAGIC 0x58444948 // "HIDX"
+#define INDEX_VERSION 3
+#define INDEX_NONE UINT32_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t strings_size;
+  uint32_t dir_count;
+  uint32_t pad;
+} IndexHeader;
+
+typedef struct {
+  uint32_t name;   // offset of the directory name in the string table
+  uint32_t key;    // offset of the case-folded name
+  uint32_t parent; // entry index of the parent, INDEX_NONE at depth 1
+  uint16_t len;
+  uint16_t depth;
+} IndexEntry;
+
+typedef struct {
+  int64_t mtime_sec;
+  uint32_t mtime_nsec;
+  uint32_t entry; // INDEX_NONE for the code root
+} IndexDir;
+
+typedef struct {
+  void *map;
+  size_t size;
+  int owned; // map is a heap buffer from index_load, not a mapping
+  uint32_t count;
+  const IndexEntry *entries;
+  const uint64_t *masks;
+  uint32_t dir_count;
+  const IndexDir *dirs;
+  const uint32_t *sorted;
+  const char *strings;
+} Index;
+
+// Return allocated path of the index file for code_root.
+char *index_path(const char *code_root);
+
+// Walk code_root and atomically replace its index. Returns 1 on success.
+int index_build(const char *code_root);
+
+// Map the index for code_root. Returns 0 if it is missing or unusable.
+int index_open(const char *code_root, Index *idx);
+
+// Re-stat the directories recorded in an open index and, if any changed,
+// re-list just those, then rewrite the file and re-attach idx to the new
+// contents. Returns 0 only if idx is no longer usable.
+int index_refresh(const char *code_root, Index *idx);
+
+// Refresh the index file of code_root, if it has one, after a change the
+// caller made (a clone).
+void index_update(const char *code_root);
+
+// Walk code_root and build the same index in memory, for callers that
+// need the name table when no index file exists.
+int index_load(const char *code_root, Index *idx);
+
+// Same, from a tree the caller already walked.
+int index_from_tree(const char *code_root, const WalkNode *root, Index *idx);
+
+void index_close(Index *idx);
+
+// Write the full path of entry i. Returns 0 if it doesn't fit.
+int index_entry_path(const Index *idx,
+                     uint32_t i,
+                     const char *code_root,
+                     char *path,
+                     size_t path_size);
+
+// Add the full path of every directory named term, deepest first and in
+// walk order on ties (search_dir's preference). Returns the match count.
+int index_lookup(const Index *idx,
+                 const char *code_root,
+                 const char *term,
+                 int case_sensitive,
+                 Matches *matches);
+
+// Range [start, *end) of the sorted table whose case-folded names start with
+// prefix. Returns start.
+uint32_t index_prefix(const Index *idx, const char *prefix, uint32_t *end);
+
+#endif
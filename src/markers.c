@@ -0,0 +1,76 @@
+#define _DEFAULT_SOURCE
+#include "markers.h"
+#include "trace.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int markers_parse(MarkerSet *set, const char *spec) {
+  memset(set, 0, sizeof(*set));
+  set->names = strdup(spec && spec[0] ? spec : DEFAULT_MARKERS);
+  if (!set->names)
+    return 0;
+  for (char *p = set->names; p && set->count < MAX_MARKERS;) {
+    char *name = p;
+    p = strchr(p, ':');
+    if (p)
+      *p++ = '\0';
+    size_t len = strlen(name);
+    int want_dir = len > 0 && name[len - 1] == '/';
+    if (want_dir)
+      name[--len] = '\0';
+    if (len > 0 && !strchr(name, '/'))
+      set->items[set->count++] = (Marker){.name = name, .want_dir = want_dir};
+  }
+  return 1;
+}
+
+void markers_free(MarkerSet *set) {
+  free(set->names);
+  set->names = NULL;
+  set->count = 0;
+}
+
+int markers_match(const MarkerSet *set, int dir_fd, const char *name, unsigned char d_type) {
+  int type = d_type;
+  for (int i = 0; i < set->count; i++) {
+    const Marker *m = &set->items[i];
+    if (strcmp(name, m->name) != 0)
+      continue;
+    // Resolve links and unknown types once, even if the name is listed as
+    // both a file and a directory marker.
+    if (type == DT_LNK || type == DT_UNKNOWN) {
+      struct stat st;
+      trace_count(TRACE_STATS, 1);
+      if (fstatat(dir_fd, name, &st, 0) != 0)
+        return 0;
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : -1;
+    }
+    if (type == (m->want_dir ? DT_DIR : DT_REG))
+      return 1;
+  }
+  return 0;
+}
+
+int markers_in_dir(const MarkerSet *set, const char *dir) {
+  if (set->count == 0)
+    return 0;
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  trace_count(TRACE_DIRS, 1);
+  DIR *d = fdopendir(fd);
+  if (!d) {
+    close(fd);
+    return 0;
+  }
+  int found = 0;
+  struct dirent *ent;
+  while (!found && (ent = readdir(d)))
+    found = markers_match(set, fd, ent->d_name, ent->d_type);
+  closedir(d);
+  return found;
+}
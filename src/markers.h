@@ -0,0 +1,36 @@
+#ifndef MARKERS_H
+#define MARKERS_H
+
+// Files and directories whose presence makes a directory a project root.
+// A set is written as a colon-separated list in which a trailing '/' means
+// the marker must be a directory and no slash means a regular file.
+
+#define MAX_MARKERS 32
+#define DEFAULT_MARKERS ".git/:.hg/:.envrc:Gemfile"
+
+typedef struct {
+  const char *name;
+  int want_dir;
+} Marker;
+
+typedef struct {
+  Marker items[MAX_MARKERS];
+  int count;
+  char *names; // storage for the names above
+} MarkerSet;
+
+// Parse spec, or DEFAULT_MARKERS if spec is NULL or empty. Returns 0 on
+// allocation failure.
+int markers_parse(MarkerSet *set, const char *spec);
+
+void markers_free(MarkerSet *set);
+
+// Whether a directory entry is a marker. d_type is the dirent type; links
+// and unknown types are resolved with fstatat relative to dir_fd.
+int markers_match(const MarkerSet *set, int dir_fd, const char *name, unsigned char d_type);
+
+// Whether dir contains any marker, found with one open and one readdir
+// pass however many markers there are.
+int markers_in_dir(const MarkerSet *set, const char *dir);
+
+#endif
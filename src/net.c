@@ -0,0 +1,120 @@
+#define _DEFAULT_SOURCE
+#include "net.h"
+#include "trace.h"
+#include "util.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const char *const net_status_names[NET_STATUSES] = {
+  [NET_ERROR] = "error",
+  [NET_OK] = "ok",
+  [NET_NOT_MODIFIED] = "not-modified",
+  [NET_NOT_FOUND] = "not-found",
+};
+
+static int start(NetHelper *net) {
+  if (net->conn)
+    return 1;
+  if (net->failed)
+    return 0;
+  net->failed = 1;
+
+  char exe[PATH_MAX];
+  sibling_path("h-net", net->argv0 ? net->argv0 : "h", exe, sizeof(exe));
+  // A socketpair rather than pipes so a helper that died can be written
+  // to with MSG_NOSIGNAL instead of raising SIGPIPE in h (ignoring SIGPIPE
+  // would be inherited by git).
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+    return 0;
+  pid_t pid = fork();
+  if (pid == 0) {
+    reset_child_signals();
+    dup2(sv[1], STDIN_FILENO);
+    dup2(sv[1], STDOUT_FILENO);
+    execl(exe, "h-net", (char *)NULL);
+    _exit(127);
+  }
+  close(sv[1]);
+  if (pid < 0) {
+    close(sv[0]);
+    return 0;
+  }
+  net->conn = fdopen(sv[0], "r");
+  if (!net->conn) {
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    return 0;
+  }
+  net->pid = pid;
+  net->failed = 0;
+  return 1;
+}
+
+static int send_line(NetHelper *net, const char *line, size_t len) {
+  int fd = fileno(net->conn);
+  while (len > 0) {
+    ssize_t n = send(fd, line, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return 0;
+    line += n;
+    len -= n;
+  }
+  return 1;
+}
+
+int net_split(char *line, char **fields, int max) {
+  int n = 0;
+  line[strcspn(line, "\n")] = '\0';
+  while (n < max) {
+    fields[n++] = line;
+    line = strchr(line, '\t');
+    if (!line)
+      break;
+    *line++ = '\0';
+  }
+  return n;
+}
+
+int net_github(NetHelper *net, const char *user, const char *repo, GithubCacheRecord *rec) {
+  if (!start(net))
+    return NET_ERROR;
+
+  char line[512];
+  int len = snprintf(line, sizeof(line), "github\t%s\t%s\t%s\n", user, repo, rec->etag);
+  if (len >= (int)sizeof(line) || !send_line(net, line, len) ||
+      !fgets(line, sizeof(line), net->conn))
+    return NET_ERROR;
+
+  char *fields[5];
+  if (net_split(line, fields, 5) != 5)
+    return NET_ERROR;
+  trace_count(TRACE_BYTES, strtoull(fields[4], NULL, 10));
+  int status = NET_ERROR;
+  for (int i = 0; i < NET_STATUSES; i++)
+    if (strcmp(fields[0], net_status_names[i]) == 0)
+      status = i;
+  if (status != NET_OK)
+    return status;
+
+  if (strlen(fields[1]) >= sizeof(rec->owner) || strlen(fields[2]) >= sizeof(rec->repo) ||
+      strlen(fields[3]) >= sizeof(rec->etag))
+    return NET_ERROR;
+  strcpy(rec->owner, fields[1]);
+  strcpy(rec->repo, fields[2]);
+  strcpy(rec->etag, fields[3]);
+  return NET_OK;
+}
+
+void net_stop(NetHelper *net) {
+  if (!net->conn)
+    return;
+  // EOF on its input tells the helper to exit.
+  fclose(net->conn);
+  net->conn = NULL;
+  waitpid(net->pid, NULL, 0);
+}
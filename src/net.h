@@ -0,0 +1,42 @@
+#ifndef NET_H
+#define NET_H
+
+#include "ghcache.h"
+#include <stdio.h>
+#include <sys/types.h>
+
+// Client for h-net, the helper that does h's network requests so h itself
+// never loads libcurl, cJSON or a TLS library. The helper is started on
+// first use and serves requests over a socketpair until net_stop, one line
+// each way:
+//
+//   github <TAB> user <TAB> repo <TAB> etag
+//   ok|not-modified|not-found|error <TAB> owner <TAB> repo <TAB> etag <TAB> bytes
+//
+// where bytes is what the request received, counted in h's trace.
+
+enum { NET_ERROR, NET_OK, NET_NOT_MODIFIED, NET_NOT_FOUND, NET_STATUSES };
+
+// The status words on the wire, indexed by the enum above.
+extern const char *const net_status_names[NET_STATUSES];
+
+typedef struct {
+  const char *argv0; // used to find h-net next to the running binary
+  pid_t pid;
+  FILE *conn;
+  int failed;
+} NetHelper;
+
+// Split a request or reply line in place into at most max tab-separated
+// fields. Returns the number of fields.
+int net_split(char *line, char **fields, int max);
+
+// Ask the API for the canonical casing of user/repo. If rec->etag is set
+// the request is conditional. On NET_OK rec holds the new casing and ETag;
+// on NET_NOT_MODIFIED it is left as it was.
+int net_github(NetHelper *net, const char *user, const char *repo, GithubCacheRecord *rec);
+
+// Close the connection and reap the helper, if it was started.
+void net_stop(NetHelper *net);
+
+#endif
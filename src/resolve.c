@@ -0,0 +1,898 @@
+#define _DEFAULT_SOURCE
+#include "resolve.h"
+#include "config.h"
+#include "daemon.h"
+#include "frecency.h"
+#include "fuzzy.h"
+#include "ghcache.h"
+#include "index.h"
+#include "net.h"
+#include "stats.h"
+#include "sync.h"
+#include "trace.h"
+#include "util.h"
+#include "walk.h"
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define cleanup(func) __attribute__((cleanup(func)))
+
+static void free_char(char **p) {
+  free(*p);
+}
+
+static void close_dir(DIR **p) {
+  if (*p)
+    closedir(*p);
+}
+
+static int is_valid_name_char(char c) {
+  return isalnum(c) || c == '.' || c == '-' || c == '_';
+}
+
+static int is_simple_name(const char *s) {
+  if (!*s)
+    return 0;
+  for (; *s; s++)
+    if (!is_valid_name_char(*s))
+      return 0;
+  return 1;
+}
+
+static int is_github_repo(const char *host,
+                          const char *path,
+                          char *user,
+                          size_t user_size,
+                          char *repo,
+                          size_t repo_size) {
+  if (strcmp(host, "github.com") != 0)
+    return 0;
+
+  const char *slash = strchr(path, '/');
+  if (!slash || slash == path || !slash[1])
+    return 0;
+  if (strchr(slash + 1, '/'))
+    return 0;
+
+  size_t ulen = slash - path;
+  size_t rlen = strlen(slash + 1);
+  for (size_t i = 0; i < ulen; i++)
+    if (!is_valid_name_char(path[i]))
+      return 0;
+  for (size_t i = 0; i < rlen; i++)
+    if (!is_valid_name_char(slash[1 + i]))
+      return 0;
+
+  strncpy(user, path, ulen < user_size ? ulen : user_size - 1);
+  user[ulen < user_size ? ulen : user_size - 1] = '\0';
+  strncpy(repo, slash + 1, repo_size - 1);
+  repo[repo_size - 1] = '\0';
+  return 1;
+}
+
+// Fix the casing of user/repo from the cache, going to the API only for
+// unknown or expired entries. Stale entries still answer when the network
+// is down.
+static void correct_github_casing(NetHelper *net,
+                                  char *user,
+                                  size_t user_size,
+                                  char *repo,
+                                  size_t repo_size) {
+  GithubCacheRecord rec = {0};
+  int cached = ghcache_lookup(user, repo, &rec);
+  if (!cached || !ghcache_fresh(&rec, time(NULL))) {
+    if (rec.state != GHCACHE_FOUND)
+      rec.etag[0] = '\0';
+    trace_phase("github_api");
+    int fetched = net_github(net, user, repo, &rec);
+    trace_phase("resolve");
+    switch (fetched) {
+    case NET_OK:
+    case NET_NOT_MODIFIED:
+      rec.state = GHCACHE_FOUND;
+      ghcache_store(user, repo, &rec);
+      cached = 1;
+      break;
+    case NET_NOT_FOUND:
+      rec.state = GHCACHE_MISSING;
+      ghcache_store(user, repo, &rec);
+      return;
+    default:
+      break;
+    }
+  }
+
+  if (cached && rec.state == GHCACHE_FOUND) {
+    strncpy(user, rec.owner, user_size - 1);
+    user[user_size - 1] = '\0';
+    strncpy(repo, rec.repo, repo_size - 1);
+    repo[repo_size - 1] = '\0';
+  }
+}
+
+static void strip_git_extension(char *path) {
+  size_t len = strlen(path);
+  if (len > 4 && strcmp(path + len - 4, ".git") == 0)
+    path[len - 4] = '\0';
+}
+
+// Find dir/<name> ignoring case, writing the on-disk spelling to out.
+static int find_entry_nocase(const char *dir, const char *name, char *out, size_t out_size) {
+  cleanup(close_dir) DIR *d = opendir(dir);
+  if (!d)
+    return 0;
+  trace_count(TRACE_DIRS, 1);
+  struct dirent *ent;
+  while ((ent = readdir(d))) {
+    if (strcasecmp(ent->d_name, name) != 0 || strlen(ent->d_name) >= out_size)
+      continue;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    trace_count(TRACE_STATS, 1);
+    if (!is_dir(path))
+      continue;
+    strcpy(out, ent->d_name);
+    return 1;
+  }
+  return 0;
+}
+
+// Look for an existing checkout of user/repo under code_root/github.com,
+// ignoring case, and adopt its spelling. Returns 1 on a hit.
+static int find_local_checkout(const char *code_root,
+                               char *user,
+                               size_t user_size,
+                               char *repo,
+                               size_t repo_size) {
+  char name[256];
+  strncpy(name, repo, sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  strip_git_extension(name);
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/github.com/%s/%s", code_root, user, name);
+  trace_count(TRACE_STATS, 1);
+  if (is_dir(path))
+    return 1;
+
+  char dir[PATH_MAX], owner[256], found[256];
+  snprintf(dir, sizeof(dir), "%s/github.com", code_root);
+  if (!find_entry_nocase(dir, user, owner, sizeof(owner)))
+    return 0;
+  snprintf(dir, sizeof(dir), "%s/github.com/%s", code_root, owner);
+  if (!find_entry_nocase(dir, name, found, sizeof(found)))
+    return 0;
+
+  strncpy(user, owner, user_size - 1);
+  user[user_size - 1] = '\0';
+  strncpy(repo, found, repo_size - 1);
+  repo[repo_size - 1] = '\0';
+  return 1;
+}
+
+// Put the checkout of rel (<host>/<path>) in the first root that already has
+// it, else in the root the config picks for it, else in the first root.
+static void place_checkout(const Roots *roots, const char *rel, Remote *r) {
+  for (int i = 0; i < roots->count; i++) {
+    snprintf(r->path, sizeof(r->path), "%s/%s", roots->paths[i], rel);
+    trace_count(TRACE_STATS, 1);
+    if (is_dir(r->path)) {
+      snprintf(r->root, sizeof(r->root), "%s", roots->paths[i]);
+      return;
+    }
+  }
+  const char *configured = config_get(rel, "root");
+  cleanup(free_char) char *root = expand_tilde(configured ? configured : roots->paths[0]);
+  snprintf(r->root, sizeof(r->root), "%s", root);
+  snprintf(r->path, sizeof(r->path), "%s/%s", root, rel);
+}
+
+static void setup_github_clone(NetHelper *net,
+                               const Roots *roots,
+                               char *user,
+                               size_t user_size,
+                               char *repo,
+                               size_t repo_size,
+                               Remote *r) {
+  int found = 0;
+  for (int i = 0; i < roots->count && !found; i++)
+    found = find_local_checkout(roots->paths[i], user, user_size, repo, repo_size);
+  if (!found)
+    correct_github_casing(net, user, user_size, repo, repo_size);
+  strip_git_extension(repo);
+  snprintf(r->url, sizeof(r->url), "https://github.com/%s/%s.git", user, repo);
+  char rel[PATH_MAX];
+  snprintf(rel, sizeof(rel), "github.com/%s/%s", user, repo);
+  place_checkout(roots, rel, r);
+}
+
+typedef struct {
+  const WalkNode *nodes[MAX_MATCHES];
+  int count;
+} SearchResult;
+
+static void search_tree(const WalkNode *node,
+                        const char *term,
+                        int case_sensitive,
+                        SearchResult *found) {
+  for (uint32_t i = 0; i < node->child_count; i++) {
+    const WalkNode *child = node->children[i];
+
+    int match;
+    if (case_sensitive) {
+      match = strcmp(child->name, term) == 0;
+    } else {
+      match = strcasecmp(child->name, term) == 0;
+    }
+
+    if (match && found->count < MAX_MATCHES)
+      found->nodes[found->count++] = child;
+
+    search_tree(child, term, case_sensitive, found);
+  }
+}
+
+// Walk code_root and collect every match, deepest first and in readdir
+// order on ties.
+static int search_dir(const char *code_root,
+                      const char *term,
+                      int case_sensitive,
+                      int max_depth,
+                      Matches *matches) {
+  WalkTree tree;
+  if (!walk_tree(code_root, max_depth, 0, &tree))
+    return 0;
+  SearchResult found = {.count = 0};
+  search_tree(&tree.root, term, case_sensitive, &found);
+  for (int depth = max_depth; depth > 0; depth--) {
+    for (int i = 0; i < found.count; i++) {
+      char path[PATH_MAX];
+      if (found.nodes[i]->depth == depth &&
+          walk_node_path(found.nodes[i], code_root, path, sizeof(path)))
+        matches_add(matches, path);
+    }
+  }
+  walk_free(&tree);
+  return matches->count;
+}
+
+// Indexes of the code roots, opened on first use and shared by the lookups
+// of one h --resolve or --resolve-batch.
+enum { ROOT_UNTRIED, ROOT_INDEXED, ROOT_UNINDEXED, ROOT_UNREADABLE };
+
+typedef struct {
+  Index idx[MAX_ROOTS];
+  int state[MAX_ROOTS];
+} RootIndexes;
+
+static void root_indexes_close(RootIndexes *ri) {
+  for (int i = 0; i < MAX_ROOTS; i++)
+    index_close(&ri->idx[i]);
+}
+
+// The index of root i, read into memory by walking it if it has no index
+// file and load is set. Roots after the first are used from their index
+// file as it is: they are only searched on a miss in the roots before them,
+// and re-checking every directory of a large archive on a network mount
+// would cost more than the lookup.
+static const Index *root_index(RootIndexes *ri, const Roots *roots, int i, int load) {
+  const char *root = roots->paths[i];
+  if (ri->state[i] == ROOT_UNTRIED) {
+    trace_phase("index");
+    int ok = index_open(root, &ri->idx[i]) && (i > 0 || index_refresh(root, &ri->idx[i]));
+    if (!ok)
+      index_close(&ri->idx[i]);
+    ri->state[i] = ok ? ROOT_INDEXED : ROOT_UNINDEXED;
+  }
+  if (ri->state[i] == ROOT_UNINDEXED && load) {
+    trace_phase("walk");
+    ri->state[i] = index_load(root, &ri->idx[i]) ? ROOT_INDEXED : ROOT_UNREADABLE;
+  }
+  return ri->state[i] == ROOT_INDEXED ? &ri->idx[i] : NULL;
+}
+
+// Look a project name up root by root, stopping at the first root with a
+// match, and exact matches in every root before fuzzy ones; unless
+// fuzzy_only, a fuzzy match must score fuzzy_min_score. shared says ri
+// serves more lookups, so a root without an index file is read into memory
+// once instead of being walked for each. Returns 1 if the matches came
+// from falling back to fuzzy matching after no exact match.
+static int lookup_name(const Roots *roots,
+                       RootIndexes *ri,
+                       const char *term,
+                       int fuzzy_only,
+                       int shared,
+                       Matches *matches) {
+  int case_sensitive = 0;
+  for (const char *c = term; *c; c++)
+    case_sensitive |= isupper((unsigned char)*c) != 0;
+
+  for (int fuzzy = fuzzy_only; fuzzy <= 1 && matches->count == 0; fuzzy++) {
+    for (int i = 0; i < roots->count && matches->count == 0; i++) {
+      const char *root = roots->paths[i];
+      int mode = case_sensitive ? DAEMON_EXACT_CASE : DAEMON_EXACT;
+      if (fuzzy)
+        mode = fuzzy_only ? DAEMON_FUZZY : DAEMON_FALLBACK;
+      trace_phase("daemon");
+      if (daemon_query(root, mode, term, matches) >= 0)
+        continue;
+      const Index *idx = root_index(ri, roots, i, fuzzy || shared);
+      if (fuzzy) {
+        trace_phase("fuzzy");
+        if (idx)
+          fuzzy_lookup(idx, root, term, fuzzy_only ? FUZZY_NONE : fuzzy_min_score(term), matches);
+      } else if (idx) {
+        index_lookup(idx, root, term, case_sensitive, matches);
+      } else if (ri->state[i] == ROOT_UNINDEXED) {
+        trace_phase("walk");
+        search_dir(root, term, case_sensitive, 3, matches);
+      }
+    }
+    if (matches->count > 0)
+      return fuzzy && !fuzzy_only;
+  }
+  return 0;
+}
+
+// Run git with args ("git" first, NULL-terminated), its output sent to
+// stderr so it can't end up in the directory we print.
+static int run_git(char **args) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    reset_child_signals();
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    execvp("git", args);
+    _exit(127);
+  }
+
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    return 1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// Bring the bare mirror of url under <code-root>/.mirrors up to date,
+// creating it on first use. Only branches and the tags they carry are kept,
+// not every ref the host advertises (GitHub's pull requests, say).
+static int update_mirror(const char *url, const char *mirror) {
+  if (is_dir(mirror)) {
+    char *args[] = {"git", "-C", (char *)mirror, "fetch", "--quiet", "--prune", "--",
+                    (char *)url, "+refs/heads/*:refs/heads/*", NULL};
+    return run_git(args) == 0;
+  }
+  char parent[PATH_MAX];
+  snprintf(parent, sizeof(parent), "%s", mirror);
+  *strrchr(parent, '/') = '\0';
+  mkpath(parent);
+  char *args[] = {"git", "clone", "--bare", "--quiet", "--", (char *)url, (char *)mirror, NULL};
+  return run_git(args) == 0;
+}
+
+// How clone_repo clones, from the config file's clone key.
+enum { CLONE_FULL, CLONE_SHALLOW, CLONE_BLOBLESS };
+
+// Submodules fetched at once unless the config file says otherwise.
+#define SUBMODULE_JOBS "8"
+// Words each of git-opts and sparse may hold.
+#define MAX_PROFILE_WORDS 32
+
+// How to clone one repository, from the config file's keys for it.
+typedef struct {
+  int strategy;     // clone
+  const char *jobs; // submodule-jobs
+  char *opts_buf;   // git-opts, split in place into opts
+  char *opts[MAX_PROFILE_WORDS];
+  int nopts;
+  char *sparse_buf; // sparse, likewise
+  char *sparse[MAX_PROFILE_WORDS];
+  int nsparse;
+} CloneProfile;
+
+static void profile_free(CloneProfile *p) {
+  free(p->opts_buf);
+  free(p->sparse_buf);
+}
+
+// Split a copy of value on whitespace into words. Returns the copy.
+static char *split_words(const char *value, char **words, int *count) {
+  *count = 0;
+  char *buf = value ? strdup(value) : NULL;
+  char *save;
+  for (char *w = buf ? strtok_r(buf, " \t", &save) : NULL; w && *count < MAX_PROFILE_WORDS;
+       w = strtok_r(NULL, " \t", &save))
+    words[(*count)++] = w;
+  return buf;
+}
+
+// The checkout's <host>/<path> below its code root, as config sections
+// match it, or NULL if path isn't below root.
+static const char *remote_rel(const Remote *r) {
+  size_t root_len = strlen(r->root);
+  if (root_len == 0 || strncmp(r->path, r->root, root_len) != 0 || r->path[root_len] != '/')
+    return NULL;
+  return r->path + root_len + 1;
+}
+
+static int clone_strategy(const char *rel, const char *value) {
+  if (!value || strcmp(value, "full") == 0)
+    return CLONE_FULL;
+  if (strcmp(value, "shallow") == 0)
+    return CLONE_SHALLOW;
+  if (strcmp(value, "blobless") == 0)
+    return CLONE_BLOBLESS;
+  fprintf(stderr, "Unknown clone = %s for %s, making a full clone\n", value, rel);
+  return CLONE_FULL;
+}
+
+static void load_profile(const char *rel, CloneProfile *p) {
+  memset(p, 0, sizeof(*p));
+  p->jobs = SUBMODULE_JOBS;
+  if (!rel)
+    return;
+  p->strategy = clone_strategy(rel, config_get(rel, "clone"));
+  p->opts_buf = split_words(config_get(rel, "git-opts"), p->opts, &p->nopts);
+  p->sparse_buf = split_words(config_get(rel, "sparse"), p->sparse, &p->nsparse);
+  const char *jobs = config_get(rel, "submodule-jobs");
+  if (jobs) {
+    char *end;
+    long n = strtol(jobs, &end, 10);
+    if (*end || n < 1 || n > 1024)
+      fprintf(stderr, "Ignoring submodule-jobs = %s for %s\n", jobs, rel);
+    else
+      p->jobs = jobs;
+  }
+}
+
+// Narrow a checkout cloned with --sparse to the profile's directories.
+static int sparse_checkout(const char *path, const CloneProfile *p) {
+  char *args[MAX_PROFILE_WORDS + 6] = {"git", "-C", (char *)path, "sparse-checkout", "set"};
+  int i = 5;
+  for (int j = 0; j < p->nsparse; j++)
+    args[i++] = p->sparse[j];
+  args[i] = NULL;
+  return run_git(args);
+}
+
+// Turn a fast clone into a regular one: fetch the history and other
+// branches a shallow clone left out, then the submodules, then update
+// the mirror (if not NULL) for the next clone of url.
+static void hydrate(const char *path,
+                    int strategy,
+                    const char *jobs,
+                    const char *url,
+                    const char *mirror) {
+  if (strategy == CLONE_SHALLOW) {
+    char *widen[] = {"git", "-C", (char *)path, "config", "remote.origin.fetch",
+                     "+refs/heads/*:refs/remotes/origin/*", NULL};
+    char *unshallow[] = {"git", "-C", (char *)path, "fetch", "--quiet", "--unshallow", NULL};
+    if (run_git(widen) == 0)
+      run_git(unshallow);
+  }
+  char gitmodules[PATH_MAX];
+  if (snprintf(gitmodules, sizeof(gitmodules), "%s/.gitmodules", path) < (int)sizeof(gitmodules) &&
+      is_file(gitmodules)) {
+    char *submodules[] = {"git", "-C", (char *)path, "submodule", "update", "--init", "--recursive",
+                          "--jobs", (char *)jobs, NULL};
+    run_git(submodules);
+  }
+  if (mirror && !update_mirror(url, mirror))
+    fprintf(stderr, "Cannot update mirror %s\n", mirror);
+}
+
+// Run hydrate in a process of its own session, so that neither the shell
+// waiting for the path nor a closed terminal holds it up. Its output goes
+// to .git/h-hydrate.log in the checkout.
+static void hydrate_detached(const char *path,
+                             int strategy,
+                             const char *jobs,
+                             const char *url,
+                             const char *mirror) {
+  char log[PATH_MAX];
+  if (snprintf(log, sizeof(log), "%s/.git/h-hydrate.log", path) >= (int)sizeof(log))
+    return;
+  pid_t pid = fork();
+  if (pid < 0)
+    return;
+  if (pid > 0) {
+    // The intermediate child exits at once, leaving nothing for us (or the
+    // shell running the builtin) to reap later.
+    waitpid(pid, NULL, 0);
+    fprintf(stderr, "Fetching the rest of %s in the background, see %s\n", path, log);
+    return;
+  }
+  if (setsid() < 0 || fork() != 0)
+    _exit(0);
+  reset_child_signals();
+  int in = open("/dev/null", O_RDONLY);
+  int out = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (in < 0 || out < 0)
+    _exit(1);
+  dup2(in, STDIN_FILENO);
+  dup2(out, STDOUT_FILENO);
+  dup2(out, STDERR_FILENO);
+  closefrom(STDERR_FILENO + 1);
+  hydrate(path, strategy, jobs, url, mirror);
+  _exit(0);
+}
+
+// Clone r->url into r->path. When <root>/.mirrors exists, url is first
+// fetched into a bare mirror there and the clone borrows its objects, so a
+// repository seen before only transfers what changed since. --dissociate
+// copies the borrowed objects in, so checkouts never depend on the mirror
+// and it can be pruned or deleted at any time. A fast clone doesn't wait
+// for the mirror: it borrows whatever the mirror already has, and hydrate
+// brings the mirror up to date afterwards.
+int clone_repo(const Remote *r, int argc, char **argv, int detach) {
+  char parent[PATH_MAX];
+  snprintf(parent, sizeof(parent), "%s", r->path);
+  char *last_slash = strrchr(parent, '/');
+  if (last_slash)
+    *last_slash = '\0';
+  mkpath(parent);
+
+  const char *rel = remote_rel(r);
+  cleanup(profile_free) CloneProfile profile;
+  load_profile(rel, &profile);
+  int strategy = profile.strategy;
+
+  char mirror[PATH_MAX];
+  int has_mirror = 0, use_mirror = 0;
+  if (rel && snprintf(mirror, sizeof(mirror), "%s/.mirrors", r->root) < (int)sizeof(mirror) &&
+      is_dir(mirror) &&
+      snprintf(mirror, sizeof(mirror), "%s/.mirrors/%s.git", r->root, rel) < (int)sizeof(mirror)) {
+    has_mirror = 1;
+    if (strategy != CLONE_FULL) {
+      use_mirror = is_dir(mirror);
+    } else {
+      trace_phase("mirror");
+      use_mirror = update_mirror(r->url, mirror);
+      if (!use_mirror)
+        fprintf(stderr, "Cannot update mirror %s, cloning without it\n", mirror);
+      trace_phase("clone");
+    }
+  }
+
+  // git clone, 3 for the mirror, at most 3 for the strategy, --sparse,
+  // the options, -- url path and NULL.
+  size_t nargs = 2 + 3 + 3 + 1 + profile.nopts + argc + 3 + 1;
+  char **args = malloc(nargs * sizeof(char *));
+  if (!args)
+    return 1;
+  int i = 0;
+  args[i++] = "git";
+  args[i++] = "clone";
+  if (use_mirror) {
+    args[i++] = "--reference-if-able";
+    args[i++] = mirror;
+    args[i++] = "--dissociate";
+  }
+  if (strategy == CLONE_SHALLOW) {
+    args[i++] = "--depth=1";
+  } else if (strategy == CLONE_BLOBLESS) {
+    args[i++] = "--filter=blob:none";
+  } else if (argc == 0 && profile.nopts == 0) {
+    args[i++] = "--recursive";
+    args[i++] = "--jobs";
+    args[i++] = (char *)profile.jobs;
+  }
+  if (profile.nsparse > 0)
+    args[i++] = "--sparse";
+  // Options given to h come last, so they win over the config file's.
+  for (int j = 0; j < profile.nopts; j++)
+    args[i++] = profile.opts[j];
+  for (int j = 0; j < argc; j++)
+    args[i++] = argv[j];
+  args[i++] = "--";
+  args[i++] = (char *)r->url;
+  args[i++] = (char *)r->path;
+  assert((size_t)i < nargs);
+  args[i] = NULL;
+
+  int ret = run_git(args);
+  free(args);
+  if (ret == 0 && profile.nsparse > 0 && sparse_checkout(r->path, &profile) != 0)
+    fprintf(stderr, "Cannot set up the sparse checkout of %s, only top-level files are there\n",
+            r->path);
+  if (ret != 0 || strategy == CLONE_FULL)
+    return ret;
+
+  trace_phase("hydrate");
+  const char *hydrate_mirror = has_mirror ? mirror : NULL;
+  if (detach)
+    hydrate_detached(r->path, strategy, profile.jobs, r->url, hydrate_mirror);
+  else
+    hydrate(r->path, strategy, profile.jobs, r->url, hydrate_mirror);
+  return 0;
+}
+
+int reindex(const char *code_root) {
+  cleanup(roots_free) Roots roots;
+  roots_parse(code_root, &roots);
+  int ret = 0;
+  for (int i = 0; i < roots.count; i++) {
+    if (!index_build(roots.paths[i])) {
+      char msg[PATH_MAX + 64];
+      snprintf(msg, sizeof(msg), "Failed to index %s", roots.paths[i]);
+      ret = fail(msg);
+    }
+  }
+  return ret;
+}
+
+int resolve_remote(NetHelper *net, const Roots *roots, const char *term, Remote *r) {
+  char user[256], repo[256];
+  r->url[0] = r->root[0] = r->path[0] = '\0';
+  if (is_github_repo("github.com", term, user, sizeof(user), repo, sizeof(repo))) {
+    setup_github_clone(net, roots, user, sizeof(user), repo, sizeof(repo), r);
+    return 1;
+  }
+
+  char host[256], rel[PATH_MAX];
+  const char *repo_path;
+  if (strstr(term, "://")) {
+    const char *p = strstr(term, "://") + 3;
+    const char *slash = strchr(p, '/');
+    size_t hlen = slash ? (size_t)(slash - p) : strlen(p);
+    snprintf(host, sizeof(host), "%.*s", (int)hlen, p);
+    repo_path = slash ? slash + 1 : "";
+  } else if (strncmp(term, "git@", 4) == 0 || strncmp(term, "gitea@", 6) == 0) {
+    const char *at = strchr(term, '@');
+    const char *colon = strchr(at, ':');
+    if (!colon)
+      return 1;
+    size_t hlen = colon - at - 1;
+    snprintf(host, sizeof(host), "%.*s", (int)hlen, at + 1);
+    repo_path = colon + 1;
+  } else {
+    return 0;
+  }
+  for (char *c = host; *c; c++)
+    *c = tolower(*c);
+
+  if (is_github_repo(host, repo_path, user, sizeof(user), repo, sizeof(repo))) {
+    setup_github_clone(net, roots, user, sizeof(user), repo, sizeof(repo), r);
+  } else {
+    snprintf(r->url, sizeof(r->url), "%s", term);
+    snprintf(rel, sizeof(rel), "%s/%s", host, repo_path);
+    strip_git_extension(rel);
+    place_checkout(roots, rel, r);
+  }
+  return 1;
+}
+
+// Everything resolve_term does for a term that isn't one of h's commands.
+// argv holds the git clone options.
+static int lookup_term(const char *code_root,
+                       const char *term,
+                       int fuzzy_only,
+                       int argc,
+                       char **argv,
+                       const char *argv0,
+                       char *out,
+                       size_t out_size) {
+  cleanup(roots_free) Roots roots;
+  if (!roots_parse(code_root, &roots))
+    return fail("No code root given");
+
+  trace_phase("resolve");
+  cleanup(net_stop) NetHelper net = {.argv0 = argv0};
+  Remote r;
+
+  if (resolve_remote(&net, &roots, term, &r)) {
+    // A user/repo, URL or git address; path stays empty if it is malformed.
+  } else if (is_simple_name(term)) {
+    cleanup(root_indexes_close) RootIndexes ri = {0};
+    cleanup(matches_free) Matches matches = {.count = 0};
+    int fuzzy = lookup_name(&roots, &ri, term, fuzzy_only, 0, &matches);
+    trace_phase("frecency");
+    if (matches.count > 0)
+      snprintf(r.path, sizeof(r.path), "%s", matches.paths[frecency_pick(&matches)]);
+    // Say so, or a typo or a deleted checkout lands somewhere else silently.
+    if (fuzzy)
+      fprintf(stderr, "No %s, going to the closest match %s\n", term, r.path);
+  } else {
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Unknown pattern for %s", term);
+    return fail(msg);
+  }
+
+  if (!r.path[0]) {
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s not found", term);
+    return fail(msg);
+  }
+
+  strip_git_extension(r.path);
+
+  trace_phase("visit");
+  trace_count(TRACE_STATS, 1);
+  if (is_dir(r.path)) {
+    frecency_visit(r.path);
+    snprintf(out, out_size, "%s", r.path);
+    return 0;
+  }
+
+  if (!r.url[0]) {
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s not found", term);
+    return fail(msg);
+  }
+
+  trace_phase("clone");
+  net_stop(&net);
+  int ret = clone_repo(&r, argc, argv, 1);
+  if (ret != 0)
+    return ret;
+
+  // Pick the new checkout up now rather than on the next lookup.
+  trace_phase("index");
+  index_update(r.root);
+
+  frecency_visit(r.path);
+  snprintf(out, out_size, "%s", r.path);
+  return 0;
+}
+
+int resolve_term(const char *code_root,
+                 int argc,
+                 char **argv,
+                 const char *argv0,
+                 char *out,
+                 size_t out_size) {
+  const char *term = argv[0];
+  int opts_start = 1;
+  int fuzzy_only = 0;
+  if (strcmp(term, "--fuzzy") == 0 && argc > 1) {
+    term = argv[1];
+    opts_start = 2;
+    fuzzy_only = 1;
+    if (!is_simple_name(term))
+      return fail("Usage: h --fuzzy <name>");
+  }
+  if (strcmp(term, "-h") == 0 || strcmp(term, "--help") == 0)
+    return fail("Usage: h (<name> | <repo>/<name> | <url>) [git opts]");
+
+  // Reached through the shell function (`h --reindex`, `h --sync`, `h --stats`):
+  // stay put.
+  if (strcmp(term, "--reindex") == 0) {
+    if (!getcwd(out, out_size))
+      return fail("Cannot read the current directory");
+    return reindex(code_root);
+  }
+  if (strcmp(term, "--sync") == 0) {
+    if (!getcwd(out, out_size))
+      return fail("Cannot read the current directory");
+    return sync_main(code_root, argc - 1, argv + 1, argv0);
+  }
+  // The report goes to stderr, as stdout is the directory to go to.
+  if (strcmp(term, "--stats") == 0) {
+    if (!getcwd(out, out_size))
+      return fail("Cannot read the current directory");
+    return stats_report(stderr);
+  }
+
+  int ret = lookup_term(
+      code_root, term, fuzzy_only, argc - opts_start, argv + opts_start, argv0, out, out_size);
+  trace_result(term, ret == 0);
+  return ret;
+}
+
+enum { BATCH_LINES, BATCH_NUL, BATCH_JSON };
+
+static void print_json_string(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+static void print_result(int format, const char *term, const char *status, const char *path) {
+  if (format == BATCH_JSON) {
+    fputs("{\"term\":", stdout);
+    print_json_string(term);
+    printf(",\"status\":\"%s\",\"path\":", status);
+    if (path[0])
+      print_json_string(path);
+    else
+      fputs("null", stdout);
+    fputs("}\n", stdout);
+  } else {
+    fputs(path, stdout);
+    putchar(format == BATCH_NUL ? '\0' : '\n');
+  }
+  // The other end is usually waiting for this answer before sending the
+  // next term.
+  fflush(stdout);
+}
+
+int resolve_batch(const char *code_root, int argc, char **argv, const char *argv0) {
+  int format = BATCH_LINES, clone = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "-z") == 0)
+      format = BATCH_NUL;
+    else if (strcmp(argv[i], "--json") == 0)
+      format = BATCH_JSON;
+    else if (strcmp(argv[i], "--clone") == 0)
+      clone = 1;
+    else
+      return fail("Usage: h --resolve-batch <code-root> [-z | --json] [--clone] < terms");
+  }
+
+  cleanup(roots_free) Roots roots;
+  if (!roots_parse(code_root, &roots))
+    return fail("No code root given");
+
+  // Each root is read at most once, lazily, for all the names in the batch.
+  cleanup(root_indexes_close) RootIndexes ri = {0};
+  cleanup(net_stop) NetHelper net = {.argv0 = argv0};
+  int cloned = 0; // bit i: something was cloned into roots.paths[i]
+
+  char *term = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  // With -z, terms are NUL-terminated too, like xargs -0.
+  while ((len = getdelim(&term, &cap, format == BATCH_NUL ? '\0' : '\n', stdin)) != -1) {
+    if (len > 0 && term[len - 1] == (format == BATCH_NUL ? '\0' : '\n'))
+      term[--len] = '\0';
+    Remote r;
+    const char *status = "not-found";
+    trace_phase("resolve");
+    if (resolve_remote(&net, &roots, term, &r)) {
+      if (!r.path[0]) {
+        status = "error";
+      } else if (is_dir(r.path)) {
+        status = "found";
+      } else if (!clone) {
+        status = "not-cloned";
+      } else {
+        trace_phase("clone");
+        char *no_opts[] = {NULL};
+        status = clone_repo(&r, 0, no_opts, 1) == 0 ? "cloned" : "error";
+        for (int i = 0; i < roots.count; i++)
+          if (strcmp(roots.paths[i], r.root) == 0)
+            cloned |= 1 << i;
+      }
+      // Only an existing checkout is a result.
+      if (strcmp(status, "found") != 0 && strcmp(status, "cloned") != 0)
+        r.path[0] = '\0';
+    } else if (is_simple_name(term)) {
+      // As resolve_term, but without recording a visit.
+      cleanup(matches_free) Matches matches = {.count = 0};
+      int fuzzy = lookup_name(&roots, &ri, term, 0, 1, &matches);
+      r.path[0] = '\0';
+      if (matches.count > 0) {
+        snprintf(r.path, sizeof(r.path), "%s", matches.paths[frecency_pick(&matches)]);
+        status = "found";
+      }
+      if (fuzzy)
+        fprintf(stderr, "No %s, answering with the closest match %s\n", term, r.path);
+    } else {
+      r.path[0] = '\0';
+      status = "error";
+    }
+    print_result(format, term, status, r.path);
+  }
+  free(term);
+
+  trace_phase("index");
+  for (int i = 0; i < roots.count; i++)
+    if (cloned & (1 << i))
+      index_update(roots.paths[i]);
+  return 0;
+}
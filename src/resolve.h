@@ -0,0 +1,59 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include "net.h"
+#include "util.h"
+#include <limits.h>
+#include <stddef.h>
+
+// Turning an h term (a project name, user/repo or URL) into a directory
+// under the code root, cloning it if needed. Shared by h --resolve and the
+// bash builtin.
+
+// code_root is a colon-separated list of roots, searched in order. argv
+// holds the term followed by any git clone options; argv0 is the
+// running program, used to find h-net. Returns 0 with the directory in out,
+// or an exit status after reporting the problem on stderr.
+int resolve_term(const char *code_root,
+                 int argc,
+                 char **argv,
+                 const char *argv0,
+                 char *out,
+                 size_t out_size);
+
+// h --resolve-batch: resolve terms read from stdin, one result per term
+// on stdout, sharing one index and one h-net helper between them. argv
+// holds the options after the code root. Returns an exit status.
+int resolve_batch(const char *code_root, int argc, char **argv, const char *argv0);
+
+// Where a repository comes from and where its checkout is, or goes.
+typedef struct {
+  char url[PATH_MAX];
+  char root[PATH_MAX]; // the code root holding path
+  char path[PATH_MAX]; // <root>/<host>/<path>
+} Remote;
+
+// If term is a user/repo, URL or git address, fill in r and return 1 (with
+// an empty path if it is malformed). The checkout is looked for in each of
+// roots in turn; a new one goes to the root the config file's `root` key
+// picks, or the first. GitHub casing is corrected through net.
+int resolve_remote(NetHelper *net, const Roots *roots, const char *term, Remote *r);
+
+// Clone r with the given git options, through the root's mirror store when
+// there is one, as the config file's keys for it say:
+//   clone           full (the default, --recursive if no options are given)
+//                   clones everything up front; shallow (--depth=1) and
+//                   blobless (--filter=blob:none) get a working tree first
+//                   and then fetch the history a shallow clone left out and
+//                   the submodules, after returning with detach or before
+//   git-opts        options put before the given ones
+//   sparse          directories to check out, in a cone-mode sparse checkout
+//   submodule-jobs  submodules fetched at once (8)
+// Returns git's exit status.
+int clone_repo(const Remote *r, int argc, char **argv, int detach);
+
+// Walk each of the code roots and rewrite its index, reporting failure on stderr.
+// Returns an exit status.
+int reindex(const char *code_root);
+
+#endif
@@ -0,0 +1,179 @@
+#define _DEFAULT_SOURCE
+#include "stats.h"
+#include "util.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define cleanup(func) __attribute__((cleanup(func)))
+
+#define SLOWEST 10
+
+static void free_char(char **p) {
+  free(*p);
+}
+
+static void close_fd(int *fd) {
+  if (*fd >= 0)
+    close(*fd);
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int compare_total_desc(const void *a, const void *b) {
+  const StatsRecord *x = *(const StatsRecord *const *)a, *y = *(const StatsRecord *const *)b;
+  return x->total_us > y->total_us ? -1 : x->total_us < y->total_us;
+}
+
+// Nearest-rank percentile of n sorted values.
+static uint32_t percentile(const uint32_t *sorted, size_t n, int p) {
+  size_t rank = (n * p + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_line(FILE *out, const char *label, uint32_t *us, size_t n, size_t runs) {
+  if (n == 0)
+    return;
+  qsort(us, n, sizeof(*us), compare_u32);
+  fprintf(out,
+          "  %-12s %6zu %5.1f%%  %9.2f %9.2f %9.2f %9.2f\n",
+          label,
+          n,
+          100.0 * n / runs,
+          percentile(us, n, 50) / 1000.0,
+          percentile(us, n, 95) / 1000.0,
+          percentile(us, n, 99) / 1000.0,
+          us[n - 1] / 1000.0);
+}
+
+// Totals, then each phase over the runs that entered it: how many went to
+// the index, walked, asked the daemon or the GitHub API.
+static void report_program(FILE *out, const char *program, StatsRecord **recs, size_t n) {
+  uint32_t *us = malloc(n * sizeof(*us));
+  if (!us)
+    return;
+  size_t runs = 0, found = 0;
+  time_t first = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (strcmp(recs[i]->program, program) != 0)
+      continue;
+    us[runs++] = recs[i]->total_us;
+    found += recs[i]->result == STATS_FOUND;
+    if (!first || (time_t)recs[i]->time < first)
+      first = recs[i]->time;
+  }
+  if (runs == 0) {
+    free(us);
+    return;
+  }
+
+  char since[32];
+  strftime(since, sizeof(since), "%Y-%m-%d %H:%M", localtime(&first));
+  fprintf(out,
+          "%s: %zu lookups since %s, %zu found, %zu not found (times in ms)\n",
+          program,
+          runs,
+          since,
+          found,
+          runs - found);
+  fprintf(
+      out, "  %-12s %6s %6s  %9s %9s %9s %9s\n", "", "runs", "share", "p50", "p95", "p99", "max");
+  print_line(out, "total", us, runs, runs);
+
+  // Phases in the order they first appear.
+  const char *names[64];
+  size_t nnames = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (strcmp(recs[i]->program, program) != 0)
+      continue;
+    for (int p = 0; p < STATS_PHASES && recs[i]->phases[p].name[0]; p++) {
+      size_t j = 0;
+      while (j < nnames && strcmp(names[j], recs[i]->phases[p].name) != 0)
+        j++;
+      if (j == nnames && nnames < sizeof(names) / sizeof(*names))
+        names[nnames++] = recs[i]->phases[p].name;
+    }
+  }
+  for (size_t j = 0; j < nnames; j++) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (strcmp(recs[i]->program, program) != 0)
+        continue;
+      for (int p = 0; p < STATS_PHASES; p++) {
+        if (strcmp(recs[i]->phases[p].name, names[j]) == 0) {
+          us[m++] = recs[i]->phases[p].us;
+          break;
+        }
+      }
+    }
+    print_line(out, names[j], us, m, runs);
+  }
+  free(us);
+  fputc('\n', out);
+}
+
+// The phase that took most of a run, to say where its time went.
+static const StatsPhase *slowest_phase(const StatsRecord *r) {
+  const StatsPhase *slowest = NULL;
+  for (int p = 0; p < STATS_PHASES && r->phases[p].name[0]; p++)
+    if (!slowest || r->phases[p].us > slowest->us)
+      slowest = &r->phases[p];
+  return slowest;
+}
+
+int stats_report(FILE *out) {
+  cleanup(free_char) char *path = state_path("stats");
+  cleanup(close_fd) int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+  StatsHeader hdr;
+  if (fd < 0 || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != STATS_MAGIC) {
+    fprintf(out, "No lookups recorded yet; set H_STATS=1 to record them\n");
+    return 0;
+  }
+  if (hdr.version != STATS_VERSION)
+    return fail("The stats file is from another version of h; remove it to start over");
+
+  cleanup(free_char) char *buf = malloc(STATS_SLOTS * sizeof(StatsRecord));
+  cleanup(free_char) char *ptrs = malloc(STATS_SLOTS * sizeof(StatsRecord *));
+  if (!buf || !ptrs)
+    return fail("Out of memory");
+  ssize_t len = pread(fd, buf, STATS_SLOTS * sizeof(StatsRecord), sizeof(hdr));
+  StatsRecord *all = (StatsRecord *)buf, **recs = (StatsRecord **)ptrs;
+  size_t n = 0;
+  for (ssize_t i = 0; i < len / (ssize_t)sizeof(StatsRecord); i++) {
+    StatsRecord *r = &all[i];
+    if (r->time == 0 || r->result == STATS_NONE)
+      continue;
+    // Never trust the strings of a record torn by a concurrent writer.
+    r->program[sizeof(r->program) - 1] = '\0';
+    r->term[sizeof(r->term) - 1] = '\0';
+    for (int p = 0; p < STATS_PHASES; p++)
+      r->phases[p].name[sizeof(r->phases[p].name) - 1] = '\0';
+    recs[n++] = r;
+  }
+
+  report_program(out, "h", recs, n);
+  report_program(out, "up", recs, n);
+
+  qsort(recs, n, sizeof(*recs), compare_total_desc);
+  fprintf(out, "Slowest h lookups:\n");
+  for (size_t i = 0, shown = 0; i < n && shown < SLOWEST; i++) {
+    const StatsRecord *r = recs[i];
+    if (strcmp(r->program, "h") != 0)
+      continue;
+    const StatsPhase *phase = slowest_phase(r);
+    fprintf(out,
+            "  %9.2f ms  %-32s %s%s%s\n",
+            r->total_us / 1000.0,
+            r->term,
+            r->result == STATS_FOUND ? "" : "not found, ",
+            phase ? "mostly " : "",
+            phase ? phase->name : "");
+    shown++;
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Latency history for h --stats. With H_STATS set (and not "0"), every
+// lookup by h, the bash builtin and up stores a record of its phases in a
+// ring of STATS_SLOTS fixed-size records in $XDG_STATE_HOME/h/stats. A
+// writer claims a slot with an atomic increment of the header's counter
+// and fills it with one pwrite, so writers never wait for each other; a
+// reader may see a record being overwritten, which costs one sample.
+
+#define STATS_MAGIC 0x54415453 // "STAT"
+#define STATS_VERSION 1
+#define STATS_SLOTS 8192
+#define STATS_PHASES 8
+
+enum { STATS_NONE, STATS_FOUND, STATS_NOT_FOUND };
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t next; // slots ever claimed; the next one is next % STATS_SLOTS
+  char pad[48];
+} StatsHeader;
+
+typedef struct {
+  char name[12];
+  uint32_t us;
+} StatsPhase;
+
+typedef struct {
+  uint64_t time; // seconds since the epoch at exit, 0 for an unused slot
+  uint32_t total_us;
+  uint8_t result;
+  char program[3];
+  StatsPhase phases[STATS_PHASES]; // the first ones entered, in order
+  uint32_t dirs_opened;
+  uint32_t bytes_fetched;
+  char term[104];
+} StatsRecord;
+
+// Print percentiles per program and phase and the slowest lookups to out.
+// Returns an exit status.
+int stats_report(FILE *out);
+
+#endif
@@ -0,0 +1,290 @@
+#define _DEFAULT_SOURCE
+#include "sync.h"
+#include "index.h"
+#include "net.h"
+#include "resolve.h"
+#include "trace.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define cleanup(func) __attribute__((cleanup(func)))
+
+#define DEFAULT_JOBS 8
+#define MAX_JOBS 64
+// Output kept per job, from the end, to explain failures.
+#define LOG_SIZE 2048
+
+typedef struct {
+  char *line; // the manifest line, split in place into term and opts
+  char *term;
+  char **opts;
+  int nopts;
+  Remote remote;
+  const char *error; // why the term couldn't be synced without running git
+  int clone;         // clone a new checkout rather than fetch into one
+  pid_t pid;
+  int fd; // read end of the job's output while it runs
+  int status;
+  char log[LOG_SIZE];
+  size_t log_len;
+} SyncEntry;
+
+typedef struct {
+  SyncEntry *entries;
+  int count;
+  int running;
+  int done;
+  int failed;
+} SyncState;
+
+static void sync_free(SyncState *st) {
+  for (int i = 0; i < st->count; i++) {
+    free(st->entries[i].line);
+    free(st->entries[i].opts);
+  }
+  free(st->entries);
+}
+
+static void close_file(FILE **f) {
+  if (*f && *f != stdin)
+    fclose(*f);
+}
+
+static int read_manifest(const char *manifest, SyncState *st) {
+  cleanup(close_file) FILE *f = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+  if (!f)
+    return 0;
+  char *line = NULL;
+  size_t cap = 0, alloc = 0;
+  while (getline(&line, &cap, f) != -1) {
+    char *save, *word = strtok_r(line, " \t\r\n", &save);
+    if (!word || word[0] == '#')
+      continue;
+    if (st->count == (int)alloc) {
+      alloc = alloc ? alloc * 2 : 64;
+      SyncEntry *grown = realloc(st->entries, alloc * sizeof(*grown));
+      if (!grown) {
+        free(line);
+        return 0;
+      }
+      st->entries = grown;
+    }
+    SyncEntry *e = &st->entries[st->count];
+    memset(e, 0, sizeof(*e));
+    // The rest of the line holds at most one word per two characters.
+    e->opts = malloc(((save ? strlen(save) : 0) / 2 + 2) * sizeof(*e->opts));
+    if (!e->opts) {
+      free(line);
+      return 0;
+    }
+    e->line = line;
+    e->term = word;
+    while ((word = strtok_r(NULL, " \t\r\n", &save)))
+      e->opts[e->nopts++] = word;
+    e->opts[e->nopts] = NULL;
+    e->fd = -1;
+    st->count++;
+    line = NULL;
+    cap = 0;
+  }
+  free(line);
+  return !ferror(f);
+}
+
+static void report(SyncState *st, SyncEntry *e) {
+  st->done++;
+  int ok = !e->error && e->status == 0;
+  if (!ok)
+    st->failed++;
+  const char *what = !ok ? "failed" : e->clone ? "cloned" : "updated";
+  fprintf(stderr, "[%d/%d] %s: %s\n", st->done, st->count, e->term, what);
+}
+
+static void append_log(SyncEntry *e, const char *buf, size_t len) {
+  if (len >= LOG_SIZE) {
+    buf += len - LOG_SIZE;
+    len = LOG_SIZE;
+  }
+  if (e->log_len + len > LOG_SIZE) {
+    size_t drop = e->log_len + len - LOG_SIZE;
+    memmove(e->log, e->log + drop, e->log_len - drop);
+    e->log_len -= drop;
+  }
+  memcpy(e->log + e->log_len, buf, len);
+  e->log_len += len;
+}
+
+// Wait until at least one running job has finished, collecting output from
+// the others meanwhile. A job is over when its output reaches EOF, so only
+// our own children are waited for; inside the bash builtin, waiting for
+// any child would reap the shell's background jobs.
+static void reap(SyncState *st) {
+  struct pollfd fds[MAX_JOBS];
+  SyncEntry *owners[MAX_JOBS];
+  int n = 0;
+  for (int i = 0; i < st->count && n < MAX_JOBS; i++) {
+    if (st->entries[i].fd >= 0) {
+      fds[n] = (struct pollfd){.fd = st->entries[i].fd, .events = POLLIN};
+      owners[n++] = &st->entries[i];
+    }
+  }
+  if (poll(fds, n, -1) < 0)
+    return;
+
+  for (int i = 0; i < n; i++) {
+    if (!fds[i].revents)
+      continue;
+    SyncEntry *e = owners[i];
+    char buf[4096];
+    ssize_t len = read(e->fd, buf, sizeof(buf));
+    if (len > 0) {
+      append_log(e, buf, len);
+      continue;
+    }
+    if (len < 0 && errno == EINTR)
+      continue;
+    close(e->fd);
+    e->fd = -1;
+    int status;
+    e->status =
+        waitpid(e->pid, &status, 0) == e->pid && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    st->running--;
+    report(st, e);
+  }
+}
+
+static int start_job(NetHelper *net, SyncEntry *e) {
+  int fds[2];
+  if (pipe(fds) != 0)
+    return 0;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  pid_t pid = fork();
+  if (pid == 0) {
+    reset_child_signals();
+    if (net->conn)
+      close(fileno(net->conn));
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[1]);
+    if (e->clone)
+      _exit(clone_repo(&e->remote, e->nopts, e->opts, 0));
+    execlp("git", "git", "-C", e->remote.path, "fetch", "--quiet", "--prune", (char *)NULL);
+    _exit(127);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return 0;
+  }
+  e->pid = pid;
+  e->fd = fds[0];
+  return 1;
+}
+
+static int parse_jobs(const char *arg, int *out) {
+  char *end;
+  long n = strtol(arg, &end, 10);
+  if (*end || n < 1 || n > MAX_JOBS)
+    return 0;
+  *out = n;
+  return 1;
+}
+
+int sync_main(const char *code_root, int argc, char **argv, const char *argv0) {
+  int jobs = DEFAULT_JOBS;
+  const char *manifest = NULL;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && parse_jobs(argv[i + 1], &jobs))
+      i++;
+    else if (!manifest && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0))
+      manifest = argv[i];
+    else
+      return fail("Usage: h --sync [--jobs N] <manifest>");
+  }
+  if (!manifest)
+    return fail("Usage: h --sync [--jobs N] <manifest>");
+
+  cleanup(sync_free) SyncState st = {0};
+  if (!read_manifest(manifest, &st)) {
+    char msg[PATH_MAX + 64];
+    snprintf(msg, sizeof(msg), "Cannot read %s", manifest);
+    return fail(msg);
+  }
+
+  cleanup(roots_free) Roots roots;
+  if (!roots_parse(code_root, &roots))
+    return fail("No code root given");
+
+  trace_phase("resolve");
+  cleanup(net_stop) NetHelper net = {.argv0 = argv0};
+  for (int i = 0; i < st.count; i++) {
+    SyncEntry *e = &st.entries[i];
+    if (!resolve_remote(&net, &roots, e->term, &e->remote))
+      e->error = "not a user/repo, URL or git address";
+    else if (!e->remote.path[0])
+      e->error = "malformed address";
+    for (int j = 0; j < i && !e->error; j++)
+      if (!st.entries[j].error && strcmp(st.entries[j].remote.path, e->remote.path) == 0)
+        e->error = "same checkout as an earlier line";
+    if (e->error) {
+      report(&st, e);
+      continue;
+    }
+
+    trace_phase("sync");
+    while (st.running >= jobs)
+      reap(&st);
+    e->clone = !is_dir(e->remote.path);
+    if (start_job(&net, e)) {
+      st.running++;
+    } else {
+      e->error = "cannot start git";
+      report(&st, e);
+    }
+    trace_phase("resolve");
+  }
+  net_stop(&net);
+  trace_phase("sync");
+  while (st.running > 0)
+    reap(&st);
+
+  if (st.failed) {
+    fprintf(stderr, "\nFailed to sync %d of %d:\n", st.failed, st.count);
+    for (int i = 0; i < st.count; i++) {
+      SyncEntry *e = &st.entries[i];
+      if (e->error) {
+        fprintf(stderr, "  %s: %s\n", e->term, e->error);
+      } else if (e->status != 0) {
+        fprintf(stderr, "  %s: git exited with %d\n", e->term, e->status);
+        for (char *l = e->log, *end = e->log + e->log_len; l < end;) {
+          char *nl = memchr(l, '\n', end - l);
+          int len = nl ? nl - l : end - l;
+          if (len > 0)
+            fprintf(stderr, "    %.*s\n", len, l);
+          l += len + 1;
+        }
+      }
+    }
+  }
+
+  // Pick the new checkouts up now rather than on the next lookup.
+  trace_phase("index");
+  for (int i = 0; i < roots.count; i++) {
+    int cloned = 0;
+    for (int j = 0; j < st.count && !cloned; j++)
+      cloned = st.entries[j].clone && st.entries[j].status == 0 &&
+               strcmp(st.entries[j].remote.root, roots.paths[i]) == 0;
+    if (cloned)
+      index_update(roots.paths[i]);
+  }
+  return st.failed != 0;
+}
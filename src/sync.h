@@ -0,0 +1,14 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+// h --sync: clone or update every repository listed in a manifest, one
+// term per line (as given to h, optionally followed by git clone options),
+// with blank lines and lines starting with # ignored. Terms are resolved in
+// order through one h-net helper while up to --jobs git processes run.
+
+// argv holds the arguments after --sync: [--jobs N] <manifest>, where a
+// manifest of - is read from stdin. Progress and a summary of failures go
+// to stderr. Returns an exit status.
+int sync_main(const char *code_root, int argc, char **argv, const char *argv0);
+
+#endif
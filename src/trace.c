@@ -0,0 +1,172 @@
+#define _DEFAULT_SOURCE
+#include "trace.h"
+#include "stats.h"
+#include "util.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PHASES 16
+
+int trace_enabled;
+
+static int to_trace, to_stats, active;
+static const char *program;
+static char term[sizeof(((StatsRecord *)0)->term)];
+static int result;
+static const char *phase_names[MAX_PHASES];
+static uint64_t phase_ns[MAX_PHASES];
+static int nphases, current = -1;
+static uint64_t start_ns, phase_start_ns;
+static atomic_uint_fast64_t counters[TRACE_COUNTERS];
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void close_phase(uint64_t now) {
+  if (current >= 0)
+    phase_ns[current] += now - phase_start_ns;
+  phase_start_ns = now;
+}
+
+void trace_mark(const char *phase) {
+  close_phase(now_ns());
+  current = -1;
+  for (int i = 0; i < nphases && current < 0; i++)
+    if (strcmp(phase_names[i], phase) == 0)
+      current = i;
+  if (current < 0 && nphases < MAX_PHASES) {
+    phase_names[nphases] = phase;
+    current = nphases++;
+  }
+}
+
+void trace_add(int counter, uint64_t n) {
+  atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+void trace_set_result(const char *t, int found) {
+  snprintf(term, sizeof(term), "%s", t ? t : "");
+  result = found ? STATS_FOUND : STATS_NOT_FOUND;
+}
+
+static void emit(uint64_t now) {
+  char line[1024];
+  size_t len = snprintf(line,
+                        sizeof(line),
+                        "{\"program\":\"%s\",\"pid\":%d,\"total_us\":%llu,\"phases\":{",
+                        program,
+                        (int)getpid(),
+                        (unsigned long long)(now - start_ns) / 1000);
+  for (int i = 0; i < nphases && len < sizeof(line); i++)
+    len += snprintf(line + len,
+                    sizeof(line) - len,
+                    "%s\"%s\":%llu",
+                    i ? "," : "",
+                    phase_names[i],
+                    (unsigned long long)phase_ns[i] / 1000);
+  if (len < sizeof(line))
+    len += snprintf(line + len,
+                    sizeof(line) - len,
+                    "},\"dirs_opened\":%llu,\"stats\":%llu,\"bytes_fetched\":%llu}\n",
+                    (unsigned long long)atomic_load(&counters[TRACE_DIRS]),
+                    (unsigned long long)atomic_load(&counters[TRACE_STATS]),
+                    (unsigned long long)atomic_load(&counters[TRACE_BYTES]));
+  if (len >= sizeof(line))
+    return;
+
+  // One write per line, so concurrent processes appending to the same file
+  // don't interleave.
+  const char *dest = getenv("H_TRACE");
+  int fd = STDERR_FILENO;
+  if (strchr(dest, '/'))
+    fd = open(dest, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  ssize_t written = write(fd, line, len);
+  (void)written;
+  if (fd != STDERR_FILENO)
+    close(fd);
+}
+
+// Claim the next slot of the ring and fill it in. Only the header is
+// mapped, for the atomic increment; the record goes in with one pwrite.
+static void record(uint64_t now) {
+  StatsRecord rec = {.time = time(NULL),
+                     .total_us = (now - start_ns) / 1000,
+                     .result = result,
+                     .dirs_opened = atomic_load(&counters[TRACE_DIRS]),
+                     .bytes_fetched = atomic_load(&counters[TRACE_BYTES])};
+  snprintf(rec.program, sizeof(rec.program), "%s", program);
+  memcpy(rec.term, term, sizeof(rec.term));
+  for (int i = 0; i < nphases && i < STATS_PHASES; i++) {
+    snprintf(rec.phases[i].name, sizeof(rec.phases[i].name), "%s", phase_names[i]);
+    rec.phases[i].us = phase_ns[i] / 1000;
+  }
+
+  char *path = state_path("stats");
+  int fd;
+  StatsHeader *hdr = path ? map_file(path, sizeof(*hdr), &fd) : NULL;
+  free(path);
+  if (!hdr)
+    return;
+  if (hdr->magic == 0) {
+    hdr->magic = STATS_MAGIC;
+    hdr->version = STATS_VERSION;
+  }
+  if (hdr->magic == STATS_MAGIC && hdr->version == STATS_VERSION) {
+    uint64_t slot = __atomic_fetch_add(&hdr->next, 1, __ATOMIC_RELAXED) % STATS_SLOTS;
+    ssize_t written = pwrite(fd, &rec, sizeof(rec), sizeof(*hdr) + slot * sizeof(rec));
+    (void)written;
+  }
+  munmap(hdr, sizeof(*hdr));
+  close(fd);
+}
+
+void trace_end(void) {
+  if (!active)
+    return;
+  active = 0;
+  uint64_t now = now_ns();
+  close_phase(now);
+  if (to_trace)
+    emit(now);
+  if (to_stats && result != STATS_NONE)
+    record(now);
+}
+
+static int env_set(const char *name) {
+  const char *env = getenv(name);
+  return env && env[0] && strcmp(env, "0") != 0;
+}
+
+void trace_begin(const char *name) {
+  to_trace = env_set("H_TRACE");
+  to_stats = env_set("H_STATS");
+  trace_enabled = active = to_trace || to_stats;
+  if (!active)
+    return;
+  program = name;
+  memset(phase_ns, 0, sizeof(phase_ns));
+  nphases = 0;
+  current = -1;
+  for (int i = 0; i < TRACE_COUNTERS; i++)
+    atomic_store(&counters[i], 0);
+  term[0] = '\0';
+  result = STATS_NONE;
+  start_ns = phase_start_ns = now_ns();
+}
+
+void trace_start(const char *name) {
+  trace_begin(name);
+  if (active)
+    atexit(trace_end);
+}
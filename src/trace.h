@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Opt-in instrumentation. With H_TRACE set (and not "0"), each program
+// records monotonic time per phase plus a few counters and prints them as
+// one JSON line at exit: to stderr, or appended to H_TRACE if it contains
+// a '/'. With H_STATS set, lookups also go to the history h --stats reads
+// (see stats.h). Disabled, every hook below is a single predictable branch.
+
+enum { TRACE_DIRS, TRACE_STATS, TRACE_BYTES, TRACE_COUNTERS };
+
+extern int trace_enabled;
+
+// Check H_TRACE and H_STATS and start the clock. Call first thing in main.
+void trace_start(const char *program);
+
+// Like trace_start, but reported by trace_end rather than at exit, for
+// each call of the bash builtin.
+void trace_begin(const char *program);
+void trace_end(void);
+
+void trace_mark(const char *phase);
+void trace_add(int counter, uint64_t n);
+void trace_set_result(const char *term, int found);
+
+// End the current phase and start the named one. Time spent in a phase
+// that is entered several times adds up.
+static inline void trace_phase(const char *phase) {
+  if (__builtin_expect(trace_enabled, 0))
+    trace_mark(phase);
+}
+
+// Count directories opened, stat calls or bytes fetched. Safe from any
+// thread.
+static inline void trace_count(int counter, uint64_t n) {
+  if (__builtin_expect(trace_enabled, 0))
+    trace_add(counter, n);
+}
+
+// Record what was looked up and whether it was found. Only runs that call
+// this are kept for h --stats.
+static inline void trace_result(const char *term, int found) {
+  if (__builtin_expect(trace_enabled, 0))
+    trace_set_result(term, found);
+}
+
+#endif
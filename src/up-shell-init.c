@@ -6,14 +6,61 @@
 #include <string.h>
 #include <unistd.h>
 
+// up as a lookup in a table the shell fills as it changes directory, so
+// that up itself never forks. The hook runs up once for each directory not
+// seen before; its answer only changes when a marker is added or removed,
+// which "up -r" (or emptying _up_roots) picks up. The hook runs ahead of
+// any other prompt command, so it hands the last command's status on.
+static void print_hook(Shell shell, const char *env, const char *exe, const char *cd_cmd) {
+  printf("typeset -gA _up_roots 2>/dev/null || declare -A _up_roots\n"
+         "_up_hook() {\n"
+         "  local s=$?\n"
+         "  [[ -n ${_up_roots[$PWD]+x} ]] && return $s\n"
+         "  _up_dir=$(%scommand %s) && _up_roots[$PWD]=$_up_dir\n"
+         "  return $s\n"
+         "}\n"
+         "up() {\n"
+         "  case \"$1\" in\n"
+         "  -h | --help) %scommand %s \"$1\" >/dev/null; return ;;\n"
+         "  -r) _up_roots=() ;;\n"
+         "  esac\n"
+         "  _up_hook\n"
+         "  _up_dir=${_up_roots[$PWD]-}\n"
+         "  [ -n \"$_up_dir\" ] && [ \"$_up_dir\" != \"$PWD\" ] && %s \"$_up_dir\"\n"
+         "}\n",
+         env,
+         exe,
+         env,
+         exe,
+         cd_cmd);
+  if (shell == SHELL_ZSH)
+    printf("autoload -Uz add-zsh-hook\n"
+           "add-zsh-hook chpwd _up_hook\n");
+  else
+    printf("case \";$PROMPT_COMMAND;\" in\n"
+           "  *\";_up_hook;\"*) ;;\n"
+           "  *) PROMPT_COMMAND=\"_up_hook${PROMPT_COMMAND:+;$PROMPT_COMMAND}\" ;;\n"
+           "esac\n");
+  // The directory the shell starts in.
+  printf("_up_hook\n");
+}
+
 int main(int argc, char **argv) {
   const char *cd_cmd = "cd";
+  const char *markers = NULL;
+  int hook = 0;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--pushd") == 0) {
       cd_cmd = "pushd";
+    } else if (strcmp(argv[i], "--hook") == 0) {
+      hook = 1;
+    } else if (strcmp(argv[i], "--markers") == 0 && i + 1 < argc) {
+      markers = argv[++i];
+      if (strchr(markers, '\''))
+        return fail("--markers cannot contain a single quote");
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-      printf("Usage: eval \"$(up-shell-init [--pushd])\"\n");
+      printf("Usage: eval \"$(up-shell-init [--pushd] [--hook] [--markers LIST])\"\n");
       return 0;
     } else {
       char msg[512];
@@ -23,33 +70,27 @@ int main(int argc, char **argv) {
   }
 
   char exe[PATH_MAX];
-  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
-  if (len == -1) {
-    char *pwd = getenv("PWD");
-    if (!pwd)
-      pwd = ".";
-    if (argv[0][0] == '/')
-      strncpy(exe, argv[0], sizeof(exe) - 1);
-    else
-      snprintf(exe, sizeof(exe), "%s/%s", pwd, argv[0]);
-  } else {
-    exe[len] = '\0';
-  }
+  program_path("up", argv[0], exe, sizeof(exe));
+
+  // Markers are passed per call so they don't leak into the environment.
+  char env[1024] = "";
+  if (markers)
+    snprintf(env, sizeof(env), "UP_MARKERS='%s' ", markers);
 
-  // Replace "up-shell-init" with "up" in the path
-  char *basename = strrchr(exe, '/');
-  if (basename) {
-    snprintf(basename + 1, sizeof(exe) - (basename - exe) - 1, "up");
-  } else {
-    strncpy(exe, "up", sizeof(exe) - 1);
+  // The table needs associative arrays, which plain sh doesn't have.
+  Shell shell = hook ? parent_shell() : SHELL_UNKNOWN;
+  if (shell != SHELL_UNKNOWN) {
+    print_hook(shell, env, exe, cd_cmd);
+    return 0;
   }
 
   printf("up() {\n"
-         "  _up_dir=$(command %s \"$@\")\n"
+         "  _up_dir=$(%scommand %s \"$@\")\n"
          "  if [ $? = 0 ]; then\n"
          "    [ \"$_up_dir\" != \"$PWD\" ] && %s \"$_up_dir\"\n"
          "  fi\n"
          "}\n",
+         env,
          exe,
          cd_cmd);
 
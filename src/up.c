@@ -1,45 +1,33 @@
 #define _DEFAULT_SOURCE
+#include "markers.h"
+#include "trace.h"
 #include "util.h"
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <unistd.h>
 
 static int is_root(const char *path) {
   return strcmp(path, "/") == 0;
 }
 
-static int is_home(const char *path) {
-  const char *home = getenv("HOME");
-  return home && strcmp(path, home) == 0;
-}
-
-static int is_project_root(const char *dir) {
-  char path[PATH_MAX];
-
-  snprintf(path, sizeof(path), "%s/.git", dir);
-  if (is_dir(path))
-    return 1;
-
-  snprintf(path, sizeof(path), "%s/.hg", dir);
-  if (is_dir(path))
-    return 1;
-
-  snprintf(path, sizeof(path), "%s/.envrc", dir);
-  if (is_file(path))
-    return 1;
+// Everything is_project_root needs that doesn't change between ancestors,
+// looked up once.
+typedef struct {
+  MarkerSet markers;
+  const char *home;
+  const char *direnv_root;
+} Detector;
 
-  snprintf(path, sizeof(path), "%s/Gemfile", dir);
-  if (is_file(path))
-    return 1;
+static int is_home(const Detector *det, const char *path) {
+  return det->home && strcmp(path, det->home) == 0;
+}
 
-  const char *direnv_dir = getenv("DIRENV_DIR");
-  if (direnv_dir && direnv_dir[0] == '-' && strcmp(dir, direnv_dir + 1) == 0)
+static int is_project_root(const Detector *det, const char *dir) {
+  if (det->direnv_root && strcmp(dir, det->direnv_root) == 0)
     return 1;
-
-  return 0;
+  return markers_in_dir(&det->markers, dir);
 }
 
 static void parent_dir(char *path) {
@@ -52,6 +40,7 @@ static void parent_dir(char *path) {
 }
 
 int main(int argc, char **argv) {
+  trace_start("up");
   if (argc > 1) {
     if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
       return fail_with_cwd("up is not installed\n\nUsage: eval \"$(up-shell-init [--pushd])\"");
@@ -68,22 +57,34 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // DIRENV_DIR is "-<dir>" for the directory direnv loaded from.
+  Detector det = {.home = getenv("HOME")};
+  const char *direnv_dir = getenv("DIRENV_DIR");
+  if (direnv_dir && direnv_dir[0] == '-')
+    det.direnv_root = direnv_dir + 1;
+  if (!markers_parse(&det.markers, getenv("UP_MARKERS")))
+    return fail_with_cwd("Out of memory");
+
+  trace_phase("scan");
   char dir[PATH_MAX];
   strncpy(dir, cwd, sizeof(dir) - 1);
   dir[sizeof(dir) - 1] = '\0';
 
-  if (is_project_root(dir)) {
+  if (is_project_root(&det, dir)) {
     parent_dir(dir);
   }
 
-  while (!is_root(dir) && !is_home(dir)) {
-    if (is_project_root(dir)) {
-      puts(dir);
-      return 0;
+  int found = 0;
+  while (!is_root(dir) && !is_home(&det, dir)) {
+    if (is_project_root(&det, dir)) {
+      found = 1;
+      break;
     }
     parent_dir(dir);
   }
 
-  puts(cwd);
+  trace_result("", found);
+  puts(found ? dir : cwd);
+  markers_free(&det.markers);
   return 0;
 }
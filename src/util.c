@@ -1,9 +1,11 @@
 #define _DEFAULT_SOURCE
 #include "util.h"
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -19,6 +21,25 @@ char *expand_tilde(const char *path) {
   return result;
 }
 
+int roots_parse(const char *spec, Roots *roots) {
+  roots->count = 0;
+  char *copy = strdup(spec);
+  if (!copy)
+    return 0;
+  char *save;
+  for (char *root = strtok_r(copy, ":", &save); root && roots->count < MAX_ROOTS;
+       root = strtok_r(NULL, ":", &save))
+    roots->paths[roots->count++] = expand_tilde(root);
+  free(copy);
+  return roots->count;
+}
+
+void roots_free(Roots *roots) {
+  for (int i = 0; i < roots->count; i++)
+    free(roots->paths[i]);
+  roots->count = 0;
+}
+
 int fail(const char *msg) {
   if (msg)
     fprintf(stderr, "%s\n", msg);
@@ -43,3 +64,152 @@ int is_file(const char *path) {
   struct stat st;
   return stat(path, &st) == 0 && S_ISREG(st.st_mode);
 }
+
+uint64_t hash_str(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+  return h;
+}
+
+int multicall;
+const char *self_exe;
+const sigset_t *child_sigmask;
+
+void reset_child_signals(void) {
+  if (!child_sigmask)
+    return;
+  signal(SIGCHLD, SIG_DFL);
+  sigprocmask(SIG_SETMASK, child_sigmask, NULL);
+}
+
+static void self_path(const char *argv0, char *out, size_t out_size) {
+  if (self_exe) {
+    snprintf(out, out_size, "%s", self_exe);
+    return;
+  }
+  ssize_t len = readlink("/proc/self/exe", out, out_size - 1);
+  if (len == -1) {
+    char *pwd = getenv("PWD");
+    if (!pwd)
+      pwd = ".";
+    if (argv0[0] == '/')
+      snprintf(out, out_size, "%s", argv0);
+    else
+      snprintf(out, out_size, "%s/%s", pwd, argv0);
+  } else {
+    out[len] = '\0';
+  }
+}
+
+void sibling_path(const char *name, const char *argv0, char *out, size_t out_size) {
+  self_path(argv0, out, out_size);
+  char *basename = strrchr(out, '/');
+  if (basename)
+    snprintf(basename + 1, out_size - (basename - out) - 1, "%s", name);
+  else
+    snprintf(out, out_size, "%s", name);
+}
+
+void program_path(const char *name, const char *argv0, char *out, size_t out_size) {
+  if (!multicall) {
+    sibling_path(name, argv0, out, out_size);
+    return;
+  }
+  self_path(argv0, out, out_size);
+  size_t len = strlen(out);
+  snprintf(out + len, out_size - len, " %s", name);
+}
+
+Shell parent_shell(void) {
+  char path[64], comm[256] = "";
+  snprintf(path, sizeof(path), "/proc/%d/comm", getppid());
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return SHELL_UNKNOWN;
+  if (fgets(comm, sizeof(comm), f))
+    comm[strcspn(comm, "\n")] = '\0';
+  fclose(f);
+  if (strcmp(comm, "zsh") == 0)
+    return SHELL_ZSH;
+  if (strcmp(comm, "bash") == 0)
+    return SHELL_BASH;
+  return SHELL_UNKNOWN;
+}
+
+void mkpath(const char *path) {
+  char tmp[PATH_MAX];
+  strncpy(tmp, path, sizeof(tmp) - 1);
+  tmp[sizeof(tmp) - 1] = '\0';
+  for (char *p = tmp + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      mkdir(tmp, 0755);
+      *p = '/';
+    }
+  }
+  mkdir(tmp, 0755);
+}
+
+static char *xdg_path(const char *env, const char *fallback, const char *name, int create) {
+  char dir[PATH_MAX];
+  const char *xdg = getenv(env);
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0] == '/')
+    snprintf(dir, sizeof(dir), "%s/h", xdg);
+  else if (home)
+    snprintf(dir, sizeof(dir), "%s/%s/h", home, fallback);
+  else
+    return NULL;
+  if (create && !is_dir(dir))
+    mkpath(dir);
+  size_t len = strlen(dir) + strlen(name) + 2;
+  char *result = malloc(len);
+  snprintf(result, len, "%s/%s", dir, name);
+  return result;
+}
+
+char *cache_path(const char *name) {
+  return xdg_path("XDG_CACHE_HOME", ".cache", name, 1);
+}
+
+char *state_path(const char *name) {
+  return xdg_path("XDG_STATE_HOME", ".local/state", name, 1);
+}
+
+char *config_path(const char *name) {
+  return xdg_path("XDG_CONFIG_HOME", ".config", name, 0);
+}
+
+void *map_file(const char *path, size_t size, int *fd) {
+  *fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (*fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(*fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(*fd, size) != 0)) {
+    close(*fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (map == MAP_FAILED) {
+    close(*fd);
+    return NULL;
+  }
+  return map;
+}
+
+int matches_add(Matches *m, const char *path) {
+  if (m->count == MAX_MATCHES)
+    return 0;
+  char *copy = strdup(path);
+  if (!copy)
+    return 0;
+  m->paths[m->count++] = copy;
+  return 1;
+}
+
+void matches_free(Matches *m) {
+  for (int i = 0; i < m->count; i++)
+    free(m->paths[i]);
+  m->count = 0;
+}
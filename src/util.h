@@ -1,6 +1,32 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_MATCHES 32
+
+// Candidate directories for a lookup, most preferred first.
+typedef struct {
+  char *paths[MAX_MATCHES];
+  int count;
+} Matches;
+
+#define MAX_ROOTS 8
+
+// Code roots in priority order, from a colon-separated list.
+typedef struct {
+  char *paths[MAX_ROOTS];
+  int count;
+} Roots;
+
+// Split spec on colons, expanding ~ in each root and skipping empty ones.
+// Returns the number of roots; any past MAX_ROOTS are ignored.
+int roots_parse(const char *spec, Roots *roots);
+
+void roots_free(Roots *roots);
+
 // Expand leading ~ to $HOME. Returns allocated string.
 char *expand_tilde(const char *path);
 
@@ -16,4 +42,60 @@ int is_dir(const char *path);
 // Check if path is a regular file.
 int is_file(const char *path);
 
+// 64-bit FNV-1a hash of a string.
+uint64_t hash_str(const char *s);
+
+// Path of the running program when /proc/self/exe would name something
+// else, as in the bash builtin where it is bash.
+extern const char *self_exe;
+
+// The signal mask to give children, set by the bash builtin while it
+// blocks SIGCHLD; NULL when children can keep ours.
+extern const sigset_t *child_sigmask;
+
+// Call first thing in a forked child: put back child_sigmask, with SIGCHLD
+// at its default action so a handler inherited from bash can't reap the
+// child's own children.
+void reset_child_signals(void);
+
+// Write the path of program name installed next to the running executable.
+// argv0 stands in for /proc/self/exe where that can't be read.
+void sibling_path(const char *name, const char *argv0, char *out, size_t out_size);
+
+// Set by the multi-call binary, in which h, up and the shell-init programs
+// are subcommands of one executable.
+extern int multicall;
+
+// Write the shell command that runs program name: its sibling executable,
+// or "<self> <name>" in the multi-call binary.
+void program_path(const char *name, const char *argv0, char *out, size_t out_size);
+
+typedef enum { SHELL_UNKNOWN, SHELL_BASH, SHELL_ZSH } Shell;
+
+// The shell that ran us, from the parent's /proc/<pid>/comm, for the
+// shell-init programs to emit only code it can parse.
+Shell parent_shell(void);
+
+// Create path and any missing parents with mode 0755.
+void mkpath(const char *path);
+
+// Return allocated path of name under $XDG_CACHE_HOME/h (or ~/.cache/h),
+// creating the directory if needed.
+char *cache_path(const char *name);
+
+// Same for $XDG_STATE_HOME/h (or ~/.local/state/h).
+char *state_path(const char *name);
+
+// Same for $XDG_CONFIG_HOME/h (or ~/.config/h), without creating it.
+char *config_path(const char *name);
+
+// Map path read-write and shared, growing it with zeros to at least size
+// bytes. The descriptor is kept in *fd for flock. Returns NULL on failure.
+void *map_file(const char *path, size_t size, int *fd);
+
+// Append a copy of path. Returns 0 once the list is full.
+int matches_add(Matches *m, const char *path);
+
+void matches_free(Matches *m);
+
 #endif
@@ -0,0 +1,530 @@
+#define _DEFAULT_SOURCE
+#include "walk.h"
+#include "markers.h"
+#include "trace.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_THREADS 8
+
+struct WalkChunk {
+  WalkChunk *next;
+  size_t used, size;
+  char data[];
+};
+
+// Per-worker deque of directories still to list. The owner pushes and pops
+// at the tail; idle workers steal the oldest entry from the head, which
+// tends to be a large subtree near the top of the tree.
+typedef struct {
+  pthread_mutex_t lock;
+  WalkNode **items;
+  size_t head, tail, cap;
+} Deque;
+
+struct WalkFilter {
+  MarkerSet markers;
+  char **ignore;
+  size_t nignore;
+};
+
+typedef struct Walker Walker;
+
+typedef struct {
+  Walker *walker;
+  int id;
+  Deque deque;
+  WalkChunk *chunks;
+  WalkNode **scratch;
+  size_t scratch_cap;
+} Worker;
+
+struct Walker {
+  int root_fd;
+  int max_depth;
+  int flags;
+  const WalkFilter *filter;
+  int nworkers;
+  Worker *workers;
+  atomic_size_t pending; // queued plus in-progress directories
+  // Idle workers sleep on idle_cond until generation moves on, which it
+  // does whenever work is queued and when pending drops to zero.
+  pthread_mutex_t idle_lock;
+  pthread_cond_t idle_cond;
+  atomic_size_t generation;
+  atomic_int sleepers;
+};
+
+static void *arena_alloc(WalkChunk **chunks, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  WalkChunk *c = *chunks;
+  if (!c || c->used + size > c->size) {
+    size_t cap = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+    c = malloc(sizeof(*c) + cap);
+    if (!c)
+      return NULL;
+    c->next = *chunks;
+    c->used = 0;
+    c->size = cap;
+    *chunks = c;
+  }
+  void *p = c->data + c->used;
+  c->used += size;
+  return p;
+}
+
+static int deque_push(Deque *q, WalkNode *node) {
+  pthread_mutex_lock(&q->lock);
+  if (q->tail == q->cap) {
+    if (q->head > 0) {
+      memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(*q->items));
+      q->tail -= q->head;
+      q->head = 0;
+    } else {
+      size_t cap = q->cap ? q->cap * 2 : 256;
+      WalkNode **p = realloc(q->items, cap * sizeof(*p));
+      if (!p) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+      }
+      q->items = p;
+      q->cap = cap;
+    }
+  }
+  q->items[q->tail++] = node;
+  pthread_mutex_unlock(&q->lock);
+  return 1;
+}
+
+static WalkNode *deque_pop(Deque *q) {
+  WalkNode *node = NULL;
+  pthread_mutex_lock(&q->lock);
+  if (q->tail > q->head)
+    node = q->items[--q->tail];
+  pthread_mutex_unlock(&q->lock);
+  return node;
+}
+
+static WalkNode *deque_steal(Deque *q) {
+  WalkNode *node = NULL;
+  pthread_mutex_lock(&q->lock);
+  if (q->tail > q->head)
+    node = q->items[q->head++];
+  pthread_mutex_unlock(&q->lock);
+  return node;
+}
+
+static int relative_path(const WalkNode *node, char *path, size_t path_size) {
+  if (node->depth == 0)
+    return snprintf(path, path_size, ".") < (int)path_size;
+  const WalkNode *chain[UINT8_MAX];
+  int n = 0;
+  for (; node && node->depth > 0 && n < UINT8_MAX; node = node->parent)
+    chain[n++] = node;
+  size_t len = 0;
+  while (n-- > 0) {
+    len += snprintf(path + len, path_size - len, len ? "/%s" : "%s", chain[n]->name);
+    if (len >= path_size)
+      return 0;
+  }
+  return 1;
+}
+
+// d_type answers "is this a directory" for most filesystems; only unknown
+// types and symlinks (which search_dir always followed) need an fstatat.
+static int entry_is_dir(int dir_fd, const struct dirent *ent) {
+  if (ent->d_type == DT_DIR)
+    return 1;
+  if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK)
+    return 0;
+  struct stat st;
+  trace_count(TRACE_STATS, 1);
+  return fstatat(dir_fd, ent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static WalkFilter *load_filter(int root_fd) {
+  WalkFilter *f = calloc(1, sizeof(*f));
+  if (!f)
+    return NULL;
+  const char *markers = getenv("H_MARKERS");
+  if (!markers)
+    markers = WALK_MARKERS;
+  if (markers[0])
+    markers_parse(&f->markers, markers);
+
+  int fd = openat(root_fd, WALK_IGNORE_FILE, O_RDONLY | O_CLOEXEC);
+  FILE *in = fd >= 0 ? fdopen(fd, "r") : NULL;
+  if (!in) {
+    if (fd >= 0)
+      close(fd);
+    return f;
+  }
+  char line[PATH_MAX];
+  size_t cap = 0;
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    // Leading slashes anchor nothing more: slashed patterns already start
+    // at the code root.
+    char *pattern = line + strspn(line, "/");
+    size_t len = strlen(pattern);
+    while (len > 0 && pattern[len - 1] == '/')
+      pattern[--len] = '\0';
+    if (!pattern[0] || line[0] == '#')
+      continue;
+    if (f->nignore == cap) {
+      cap = cap ? cap * 2 : 16;
+      char **p = realloc(f->ignore, cap * sizeof(*p));
+      if (!p)
+        break;
+      f->ignore = p;
+    }
+    if ((f->ignore[f->nignore] = strdup(pattern)))
+      f->nignore++;
+  }
+  fclose(in);
+  return f;
+}
+
+static void free_filter(WalkFilter *f) {
+  if (!f)
+    return;
+  markers_free(&f->markers);
+  for (size_t i = 0; i < f->nignore; i++)
+    free(f->ignore[i]);
+  free(f->ignore);
+  free(f);
+}
+
+// Whether the directory name, at rel below the code root, is ignored.
+static int ignored(const WalkFilter *f, const char *rel, const char *name) {
+  char path[PATH_MAX];
+  int have_path = 0;
+  for (size_t i = 0; i < f->nignore; i++) {
+    const char *pattern = f->ignore[i];
+    if (!strchr(pattern, '/')) {
+      if (fnmatch(pattern, name, 0) == 0)
+        return 1;
+      continue;
+    }
+    if (!have_path) {
+      const char *parent = strcmp(rel, ".") == 0 ? "" : rel;
+      if (snprintf(path, sizeof(path), "%s%s%s", parent, parent[0] ? "/" : "", name) >=
+          (int)sizeof(path))
+        return 0;
+      have_path = 1;
+    }
+    if (fnmatch(pattern, path, FNM_PATHNAME) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Let sleeping workers look for work again. Bumping generation before
+// reading sleepers (both sequentially consistent) pairs with the sleeper
+// counting itself before checking generation: either we see it and wake
+// it, or it sees the new generation and doesn't sleep.
+static void wake_idle(Walker *walker) {
+  atomic_fetch_add(&walker->generation, 1);
+  if (atomic_load(&walker->sleepers) == 0)
+    return;
+  pthread_mutex_lock(&walker->idle_lock);
+  pthread_cond_broadcast(&walker->idle_cond);
+  pthread_mutex_unlock(&walker->idle_lock);
+}
+
+static void list_dir(Worker *w, WalkNode *node) {
+  Walker *walker = w->walker;
+  char rel[PATH_MAX];
+  if (!relative_path(node, rel, sizeof(rel)))
+    return;
+  int fd = openat(walker->root_fd, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  trace_count(TRACE_DIRS, 1);
+  // Taken before reading so a change racing the listing still shows up
+  // as a newer mtime next time.
+  struct stat st;
+  if (walker->flags & WALK_MTIMES) {
+    trace_count(TRACE_STATS, 1);
+    if (fstat(fd, &st) == 0) {
+      node->mtime_sec = st.st_mtim.tv_sec;
+      node->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+  }
+  DIR *d = fdopendir(fd);
+  if (!d) {
+    close(fd);
+    return;
+  }
+
+  const WalkFilter *filter = walker->filter;
+  // The code root may be a checkout itself (of dotfiles, say).
+  int check_markers = filter && filter->markers.count > 0 && node->depth > 0;
+  int project = 0;
+  size_t count = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d))) {
+    if (check_markers && !project)
+      project = markers_match(&filter->markers, fd, ent->d_name, ent->d_type);
+    if (ent->d_name[0] == '.' || !entry_is_dir(fd, ent))
+      continue;
+    if (filter && filter->nignore > 0 && ignored(filter, rel, ent->d_name))
+      continue;
+
+    size_t len = strlen(ent->d_name);
+    WalkNode *child = arena_alloc(&w->chunks, sizeof(*child) + len + 1);
+    if (!child)
+      break;
+    char *name = (char *)(child + 1);
+    memcpy(name, ent->d_name, len + 1);
+    *child = (WalkNode){
+      .name = name,
+      .parent = node,
+      .len = len,
+      .depth = node->depth + 1,
+    };
+
+    if (count == w->scratch_cap) {
+      size_t cap = w->scratch_cap ? w->scratch_cap * 2 : 256;
+      WalkNode **p = realloc(w->scratch, cap * sizeof(*p));
+      if (!p)
+        break;
+      w->scratch = p;
+      w->scratch_cap = cap;
+    }
+    w->scratch[count++] = child;
+  }
+  closedir(d);
+
+  // A project is a lookup target, but what's inside it never is.
+  if (count == 0 || project)
+    return;
+  WalkNode **children = arena_alloc(&w->chunks, count * sizeof(*children));
+  if (!children)
+    return;
+  memcpy(children, w->scratch, count * sizeof(*children));
+  node->children = children;
+  node->child_count = count;
+
+  if (node->depth + 1 >= walker->max_depth)
+    return;
+  // Reverse order so the owner pops children first-to-last.
+  for (size_t i = count; i-- > 0;) {
+    atomic_fetch_add(&walker->pending, 1);
+    if (!deque_push(&w->deque, children[i]))
+      atomic_fetch_sub(&walker->pending, 1);
+  }
+  wake_idle(walker);
+}
+
+static void *work(void *arg) {
+  Worker *w = arg;
+  Walker *walker = w->walker;
+  for (;;) {
+    // Read before looking, so work queued after the deques were found
+    // empty shows up as a new generation.
+    size_t seen = atomic_load(&walker->generation);
+    WalkNode *node = deque_pop(&w->deque);
+    for (int i = 1; !node && i < walker->nworkers; i++)
+      node = deque_steal(&walker->workers[(w->id + i) % walker->nworkers].deque);
+
+    if (node) {
+      list_dir(w, node);
+      if (atomic_fetch_sub(&walker->pending, 1) == 1)
+        wake_idle(walker);
+    } else if (atomic_load(&walker->pending) == 0) {
+      break;
+    } else {
+      // Others are still listing directories that may add work.
+      pthread_mutex_lock(&walker->idle_lock);
+      atomic_fetch_add(&walker->sleepers, 1);
+      while (atomic_load(&walker->generation) == seen && atomic_load(&walker->pending) != 0)
+        pthread_cond_wait(&walker->idle_cond, &walker->idle_lock);
+      atomic_fetch_sub(&walker->sleepers, 1);
+      pthread_mutex_unlock(&walker->idle_lock);
+    }
+  }
+  return NULL;
+}
+
+static int walk_threads(void) {
+  const char *env = getenv("H_WALK_THREADS");
+  long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    return 1;
+  return n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+// List the seed directories and everything below them down to max_depth,
+// adding the allocated nodes to *chunks.
+static void run(int root_fd,
+                int max_depth,
+                int flags,
+                const WalkFilter *filter,
+                WalkNode **seeds,
+                size_t nseeds,
+                WalkChunk **chunks) {
+  // Listing a single directory without descending isn't worth threads.
+  Walker walker = {
+    .root_fd = root_fd,
+    .max_depth = max_depth,
+    .flags = flags,
+    .filter = filter,
+    .nworkers = nseeds > 1 || seeds[0]->depth + 1 < max_depth ? walk_threads() : 1,
+  };
+  Worker workers[MAX_THREADS] = {0};
+  walker.workers = workers;
+  pthread_mutex_init(&walker.idle_lock, NULL);
+  pthread_cond_init(&walker.idle_cond, NULL);
+  for (int i = 0; i < walker.nworkers; i++) {
+    workers[i].walker = &walker;
+    workers[i].id = i;
+    pthread_mutex_init(&workers[i].deque.lock, NULL);
+  }
+
+  for (size_t i = nseeds; i-- > 0;) {
+    atomic_fetch_add(&walker.pending, 1);
+    if (!deque_push(&workers[0].deque, seeds[i]))
+      atomic_fetch_sub(&walker.pending, 1);
+  }
+
+  pthread_t threads[MAX_THREADS];
+  int started = 1;
+  for (; started < walker.nworkers; started++)
+    if (pthread_create(&threads[started], NULL, work, &workers[started]) != 0)
+      break;
+  work(&workers[0]);
+  for (int i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < walker.nworkers; i++) {
+    WalkChunk *c = workers[i].chunks;
+    while (c) {
+      WalkChunk *next = c->next;
+      c->next = *chunks;
+      *chunks = c;
+      c = next;
+    }
+    free(workers[i].deque.items);
+    free(workers[i].scratch);
+    pthread_mutex_destroy(&workers[i].deque.lock);
+  }
+  pthread_cond_destroy(&walker.idle_cond);
+  pthread_mutex_destroy(&walker.idle_lock);
+}
+
+void walk_init(WalkTree *tree, int flags) {
+  memset(tree, 0, sizeof(*tree));
+  tree->root.name = "";
+  tree->flags = flags;
+}
+
+void *walk_alloc(WalkTree *tree, size_t size) {
+  return arena_alloc(&tree->chunks, size);
+}
+
+int walk_tree(const char *code_root, int max_depth, int flags, WalkTree *tree) {
+  walk_init(tree, flags);
+
+  int root_fd = open(code_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0)
+    return 0;
+  tree->filter = load_filter(root_fd);
+  if (max_depth >= 1) {
+    WalkNode *root = &tree->root;
+    run(root_fd, max_depth, flags, tree->filter, &root, 1, &tree->chunks);
+  }
+  close(root_fd);
+  return 1;
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp((*(WalkNode *const *)a)->name, (*(WalkNode *const *)b)->name);
+}
+
+int walk_refresh(WalkTree *tree, const char *code_root, WalkNode *node, int max_depth) {
+  if (node->depth >= max_depth)
+    return 1;
+  int root_fd = open(code_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0)
+    return 0;
+  if (!tree->filter)
+    tree->filter = load_filter(root_fd);
+
+  // List the directory alone into a copy of the node, then carry over the
+  // existing children by name so their subtrees aren't walked again.
+  WalkNode fresh = *node;
+  fresh.children = NULL;
+  fresh.child_count = 0;
+  fresh.mtime_sec = 0;
+  fresh.mtime_nsec = 0;
+  WalkNode *seed = &fresh;
+  run(root_fd, node->depth + 1, tree->flags, tree->filter, &seed, 1, &tree->chunks);
+
+  WalkNode **old = malloc((node->child_count + 1) * sizeof(*old));
+  WalkNode **added = malloc((fresh.child_count + 1) * sizeof(*added));
+  if (!old || !added) {
+    free(old);
+    free(added);
+    close(root_fd);
+    return 0;
+  }
+  memcpy(old, node->children, node->child_count * sizeof(*old));
+  qsort(old, node->child_count, sizeof(*old), compare_names);
+
+  size_t nadded = 0;
+  for (uint32_t i = 0; i < fresh.child_count; i++) {
+    WalkNode *child = fresh.children[i];
+    WalkNode **hit = bsearch(&child, old, node->child_count, sizeof(*old), compare_names);
+    if (hit) {
+      fresh.children[i] = *hit;
+    } else {
+      child->parent = node;
+      added[nadded++] = child;
+    }
+  }
+  node->children = fresh.children;
+  node->child_count = fresh.child_count;
+  node->mtime_sec = fresh.mtime_sec;
+  node->mtime_nsec = fresh.mtime_nsec;
+
+  if (nadded > 0 && node->depth + 1 < max_depth)
+    run(root_fd, max_depth, tree->flags, tree->filter, added, nadded, &tree->chunks);
+
+  free(old);
+  free(added);
+  close(root_fd);
+  return 1;
+}
+
+void walk_free(WalkTree *tree) {
+  WalkChunk *c = tree->chunks;
+  while (c) {
+    WalkChunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  tree->chunks = NULL;
+  free_filter(tree->filter);
+  tree->filter = NULL;
+}
+
+int walk_node_path(const WalkNode *node, const char *code_root, char *path, size_t path_size) {
+  size_t len = snprintf(path, path_size, "%s", code_root);
+  if (len >= path_size)
+    return 0;
+  if (node->depth == 0)
+    return 1;
+  path[len++] = '/';
+  return relative_path(node, path + len, path_size - len);
+}
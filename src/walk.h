@@ -0,0 +1,71 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Directory tree below a code root, listed in parallel. Children keep
+// readdir order, so a preorder traversal visits directories in the same
+// order the old recursive search_dir did.
+
+typedef struct WalkNode {
+  const char *name;
+  struct WalkNode *parent;
+  struct WalkNode **children;
+  uint32_t child_count;
+  uint16_t len;
+  uint16_t depth; // 0 for the code root itself
+  // With WALK_MTIMES, the mtime of a directory when it was listed; zero if
+  // it wasn't (too deep, or it couldn't be opened).
+  int64_t mtime_sec;
+  uint32_t mtime_nsec;
+} WalkNode;
+
+typedef struct WalkChunk WalkChunk;
+typedef struct WalkFilter WalkFilter;
+
+typedef struct {
+  WalkNode root;
+  WalkChunk *chunks;
+  int flags;
+  WalkFilter *filter; // read from the code root when first walked
+} WalkTree;
+
+// The walk doesn't descend into project checkouts, only records them:
+// directories holding one of these markers (see markers.h), or the ones
+// in $H_MARKERS, which may be empty to walk every directory. Unlike up, a
+// .envrc or Gemfile doesn't count, since those also sit in directories
+// that merely group projects.
+#define WALK_MARKERS ".git/:.git:.hg/"
+
+// Name of the file in the code root listing directories to leave out of
+// the walk, one glob per line: a pattern with a slash is matched against
+// the path below the code root, one without against any directory name.
+#define WALK_IGNORE_FILE ".hignore"
+
+// Record each listed directory's mtime (one fstat per directory).
+#define WALK_MTIMES 1
+
+// List non-hidden directories up to max_depth levels below code_root,
+// short of the inside of projects and ignored directories. Returns 0 if
+// code_root itself can't be opened.
+int walk_tree(const char *code_root, int max_depth, int flags, WalkTree *tree);
+
+// Start an empty tree to be filled in by hand with walk_alloc.
+void walk_init(WalkTree *tree, int flags);
+
+// Allocate memory that lives as long as the tree.
+void *walk_alloc(WalkTree *tree, size_t size);
+
+// Re-list one directory of the tree. Children that still exist keep their
+// subtrees, new ones are walked down to max_depth and vanished ones are
+// dropped (their memory stays with the tree until walk_free).
+int walk_refresh(WalkTree *tree, const char *code_root, WalkNode *node, int max_depth);
+
+void walk_free(WalkTree *tree);
+
+// Write code_root joined with the names from the root down to node.
+// Returns 0 if the result doesn't fit.
+int walk_node_path(const WalkNode *node, const char *code_root, char *path, size_t path_size);
+
+#endif